@@ -0,0 +1,77 @@
+#include "aggregator.h"
+#include "data_logger.h"
+
+namespace coweeta {
+
+Aggregator::Aggregator(uint8_t stats, uint8_t dec_places) :
+  stats_(stats),
+  dec_places_(dec_places)
+{
+  reset();
+}
+
+
+void Aggregator::reset(void)
+{
+  count_ = 0;
+  mean_ = 0.0;
+  m2_ = 0.0;
+  min_ = 0.0;
+  max_ = 0.0;
+}
+
+
+void Aggregator::add(double value)
+{
+  if (count_++ == 0) {
+    min_ = value;
+    max_ = value;
+  } else if (value < min_) {
+    min_ = value;
+  } else if (value > max_) {
+    max_ = value;
+  }
+  const double delta = value - mean_;
+  mean_ += delta / count_;
+  m2_ += delta * (value - mean_);
+}
+
+
+double Aggregator::variance() const
+{
+  return (count_ > 1) ? m2_ / (count_ - 1) : 0.0;
+}
+
+
+void Aggregator::log_to(DataLogger &logger) const
+{
+  if (stats_ & Count) {
+    logger.log_float(count_, 0);
+  }
+  const double values[] = {mean_, min_, max_};
+  for (uint8_t i = 0; i < 3; i++) {
+    if (stats_ & (Mean << i)) {
+      if (count_) {
+        logger.log_float(values[i], dec_places_);
+      } else {
+        logger.skip_entries(1);
+      }
+    }
+  }
+  if (stats_ & Variance) {
+    if (count_ > 1) {
+      logger.log_float(variance(), dec_places_);
+    } else {
+      logger.skip_entries(1);
+    }
+  }
+  if (stats_ & StdDev) {
+    if (count_ > 1) {
+      logger.log_float(sqrt(variance()), dec_places_);
+    } else {
+      logger.skip_entries(1);
+    }
+  }
+}
+
+} // namespace coweeta
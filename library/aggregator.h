@@ -0,0 +1,67 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include "Arduino.h"
+
+namespace coweeta {
+
+class DataLogger;
+
+// The summaries an Aggregator can log for its column, or-ed together.  Each
+// is logged in a column of its own, in this order.
+typedef enum {
+  Count = 0x01,
+  Mean = 0x02,
+  Minimum = 0x04,
+  Maximum = 0x08,
+  Variance = 0x10,   // sample variance (divided by count - 1)
+  StdDev = 0x20      // its square root
+} AggregateStat;
+
+
+// Running summary of the values logged in one column of the log, for
+// DataLogger::set_aggregation().  The samples themselves are not kept: the
+// mean and variance are updated as each arrives (Welford's method, which
+// doesn't lose precision as a sum of squares would), so an Aggregator takes
+// the same few bytes whether it sees ten samples or ten thousand.
+class Aggregator
+{
+  uint8_t stats_;
+  uint8_t dec_places_;
+  uint32_t count_;
+  double mean_;
+  double m2_;        // sum of the squared differences from the mean
+  double min_;
+  double max_;
+
+public:
+  // Log the given summaries (AggregateStat values or-ed together) with
+  // dec_places digits after the decimal point; the count is a whole number.
+  Aggregator(uint8_t stats, uint8_t dec_places);
+
+  void add(double value);
+
+  // Forget the samples so far.
+  void reset(void);
+
+  inline uint32_t count() const
+  {
+    return count_;
+  }
+
+  inline double mean() const
+  {
+    return mean_;
+  }
+
+  double variance() const;
+
+  // Log the summaries of the samples so far, one column each.  Those that
+  // need more samples than there are (a mean of none, a variance of one) are
+  // left empty.
+  void log_to(DataLogger &logger) const;
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef AGGREGATOR_H
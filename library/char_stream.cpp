@@ -1,32 +1,131 @@
 #include "char_stream.h"
+#include "fixed_point.h"
 
-CharStream::CharStream(char *buffer, uint8_t size):
-    buffer_(buffer),
-    size_(size),
-    pos_(0)
+/// "00" to "99", for putting out the digits of a number a pair at a time.
+static const char DIGIT_PAIRS[201] PROGMEM =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/// Enough for "-2147483648".
+static const uint8_t MAX_INT_TEXT = 11;
+
+
+/// Write the digits of value backwards from end, returning where they start.
+/// A 32 bit division is dear on an AVR, so they are only used until what is
+/// left fits in 16 bits.
+static char *digits_before(char *end, uint32_t value)
+{
+  while (value > 0xFFFF) {
+    const uint32_t rest = value / 100;
+    end -= 2;
+    memcpy_P(end, &DIGIT_PAIRS[2 * uint8_t(value - rest * 100)], 2);
+    value = rest;
+  }
+  uint16_t small = uint16_t(value);
+  while (small >= 100) {
+    const uint16_t rest = small / 100;
+    end -= 2;
+    memcpy_P(end, &DIGIT_PAIRS[2 * uint8_t(small - rest * 100)], 2);
+    small = rest;
+  }
+  if (small >= 10) {
+    end -= 2;
+    memcpy_P(end, &DIGIT_PAIRS[2 * small], 2);
+  } else {
+    *--end = '0' + small;
+  }
+  return end;
+}
+
+
+CharStream::CharStream():
+    file_(NULL),
+    echo_(NULL),
+    length_(0)
 {
 }
 
 
+void CharStream::start(Print *file, Print *echo)
+{
+  file_ = file;
+  echo_ = echo;
+  length_ = 0;
+}
+
+
 size_t CharStream::write(const uint8_t *buffer, size_t size)
 {
-  for (size_t i = 0; i < size; i++, pos_++) {
-    if (pos_ == size_) {
-      setWriteError(1);
-      return i;
-    }
-    buffer_[pos_] = buffer[i];
+  if (file_) {
+    file_->write(buffer, size);
+  }
+  if (echo_) {
+    echo_->write(buffer, size);
   }
+  length_ += size;
   return size;
 }
 
 
 size_t CharStream::write(uint8_t ch)
 {
-  if (pos_ == size_) {
-    setWriteError(1);
-    return 0;
+  if (file_) {
+    file_->write(ch);
   }
-  buffer_[pos_++] = ch;
+  if (echo_) {
+    echo_->write(ch);
+  }
+  length_++;
   return 1;
-}
\ No newline at end of file
+}
+
+
+inline void CharStream::append_text(const char *text, uint8_t length)
+{
+  write(reinterpret_cast<const uint8_t *>(text), length);
+}
+
+
+void CharStream::append_uint(uint32_t value)
+{
+  char text[MAX_INT_TEXT];
+  char *const end = text + sizeof(text);
+  const char *start = digits_before(end, value);
+  append_text(start, end - start);
+}
+
+
+void CharStream::append_int(int32_t value)
+{
+  char text[MAX_INT_TEXT];
+  char *const end = text + sizeof(text);
+  char *start = digits_before(end, (value < 0) ? 0 - uint32_t(value) : uint32_t(value));
+  if (value < 0) {
+    *--start = '-';
+  }
+  append_text(start, end - start);
+}
+
+
+void CharStream::append_fixed(int32_t value, uint8_t scale)
+{
+  char text[coweeta::FIXED_TEXT_SIZE];
+  const uint8_t length = coweeta::format_fixed(text, value, scale);
+  append_text(text, length);
+}
+
+
+void CharStream::append_2digit(uint8_t value)
+{
+  char text[2];
+  memcpy_P(text, &DIGIT_PAIRS[2 * value], 2);
+  append_text(text, 2);
+}
@@ -1,29 +1,47 @@
 #include "Print.h"
 
+/// The text of a log line, passed on as it is built to where the line is
+/// going: the log file's write-behind buffer (see coweeta::LogBuffer), so
+/// that it lands straight in the sector to be written to the card, the
+/// serial port to the management software, or both.  Nothing is held here.
+///
+/// As a Print, anything can be written to it.  The append_ functions are the
+/// fast path for the fields of a log line: each works its field out on the
+/// stack, two digits at a time from a table, and hands it on in one write.
 class CharStream: public Print
 {
 private:
-  char *buffer_;
-  size_t size_;
-  size_t pos_;
+  Print *file_;
+  Print *echo_;
+  size_t length_;
+
+  void append_text(const char *text, uint8_t length);
 
 public:
-  CharStream(char *buffer, uint8_t size);
+  CharStream();
   size_t write(const uint8_t *buffer, size_t size);
   size_t write(uint8_t ch);
 
-  inline void reset(void)
-  {
-    pos_ = 0;
-  }
+  /// Start a line for the given destinations, either of which may be NULL.
+  void start(Print *file, Print *echo);
 
-  inline void dump(Print &dest)
+  inline void append_char(char ch)
   {
-    dest.write(buffer_, pos_);
+    write(uint8_t(ch));
   }
 
+  void append_uint(uint32_t value);
+  void append_int(int32_t value);
+
+  /// value / 10 ** scale, as coweeta::format_fixed() gives it.
+  void append_fixed(int32_t value, uint8_t scale);
+
+  /// Exactly two digits, the first maybe a zero: value is 0 to 99.
+  void append_2digit(uint8_t value);
+
+  /// Length of the line so far.
   inline size_t bytes_written(void)
   {
-    return pos_;
+    return length_;
   }
-};
\ No newline at end of file
+};
@@ -3,201 +3,291 @@
 #include "command_parser.h"
 
 
-/// Check the next char without advancing past it.
-char CommandParser::peek() {
-  return buffer_[cursor_];
+CommandParser::CommandParser()
+{
+  reset();
 }
 
 
-/// Advance the cursor to the next non-space, or the end of the string.
-void CommandParser::skip_spaces()
+/// Get ready for a new line.
+void CommandParser::reset(void)
 {
-  while ((cursor_ < size_) && (buffer_[cursor_] == ' ')) {
-    cursor_++;
-  }
+  signature_[0] = '\0';
+  state_ = START;
+  command_ = '\0';
+  error_ = NONE;
+  kind_ = 0;
+  required_ = 0;
+  count_ = 0;
+  next_ = 0;
+  text_used_ = 0;
+  digits_ = false;
 }
 
 
-/// Try to interpret the next lump of text as a decical integer.
-/// If it is not then return 0 and set the error flag.
-uint32_t CommandParser::get_int(void)
+/// Note the (first) error, and skip the rest of the line.
+void CommandParser::fail(char error)
 {
-  uint32_t val = 0;
-  char ch = buffer_[cursor_++];
-  do {
-    if ((ch < '0') || (ch > '9')) {
-        error_ = NON_DIGIT;
-        return 0;
-    }
+  if (!error_) {
+    error_ = error;
+  }
+  state_ = IGNORE;
+}
 
-    const uint8_t digit = ch - '0';
 
-    if (val > 0xFFFFFFFF / 10) {
-      error_ = OVERFLOW;
-      return 0;
-    }
-    val *= 10;
-    uint32_t new_val = val + digit;
-    if (new_val < val) {
-      error_ = OVERFLOW;
-      return 0;
+void CommandParser::set_signature(const char *signature)
+{
+  if (state_ != BETWEEN) {
+    return;
+  }
+  if (!signature) {
+    state_ = IGNORE;
+    return;
+  }
+  uint8_t size = 0;
+  bool optional = false;
+  for (uint8_t i = 0; signature[i] && (i < MAX_SIGNATURE) && (size < MAX_ARGS); i++) {
+    if (signature[i] == OPTIONAL_ARGS) {
+      if (!optional) {
+        required_ = size;
+        optional = true;
+      }
+    } else {
+      signature_[size++] = signature[i];
     }
-    val = new_val;
-    ch = buffer_[cursor_++];
-  } while (ch != ' ');
-
-  return val;
+  }
+  signature_[size] = '\0';
+  if (!optional) {
+    required_ = size;
+  }
 }
 
 
-bool CommandParser::prepare(bool skip_space)
+uint8_t CommandParser::add(char ch)
 {
-  if (error_) {
-    return true;
-  }
-  if (skip_space)
-  {
-    skip_spaces();
+  if (state_ == DONE) {
+    reset();
   }
-  if (cursor_ >= size_) {
-    error_ = MISSING;
-    return true;
+  switch (state_) {
+    case START:
+      if (ch == ' ') {
+        return MORE;
+      }
+      if (ch == '\n') {
+        fail(EMPTY);
+        state_ = DONE;
+        return LINE;
+      }
+      command_ = ch;
+      state_ = BETWEEN;
+      return COMMAND;
+
+    case BETWEEN:
+      if (ch == ' ') {
+        return MORE;
+      }
+      if (ch == '\n') {
+        end_line();
+        return LINE;
+      }
+      if (signature_[kind_] == '\0') {
+        fail(EXTRA);
+        return MORE;
+      }
+      start_field(ch);
+      return MORE;
+
+    case IN_FIELD:
+      if (ch == '\n') {
+        end_field();
+        end_line();
+        return LINE;
+      }
+      if ((ch == ' ') && (signature_[kind_] != STRING_ARG)) {
+        end_field();
+        return MORE;
+      }
+      add_to_field(ch);
+      return MORE;
+
+    default:
+      if (ch == '\n') {
+        state_ = DONE;
+        return LINE;
+      }
+      return MORE;
   }
-  return false;  // No fault.
 }
 
 
-/// Instantiate the object with the string to process, and its size.
-CommandParser::CommandParser(char * buffer, uint8_t size) :
-  buffer_(buffer),
-  size_(size),
-  cursor_(0),
-  error_(NONE)
+void CommandParser::start_field(char ch)
 {
-  skip_spaces();
+  Field &field = fields_[count_];
+  field.value = 0;
+  field.negative = false;
+  field.text = text_used_;
+  digits_ = false;
+  state_ = IN_FIELD;
+  if ((signature_[kind_] == INT_ARG) && ((ch == '-') || (ch == '+'))) {
+    field.negative = ch == '-';
+    return;
+  }
+  add_to_field(ch);
+}
 
-  const uint8_t last_char_pos = size_ - 1;
 
-  if (buffer_[last_char_pos] != '\n') {
-    error_ = BAD_TERM;
+/// Text is stored as it comes (always leaving room for its NUL); integers are
+/// worked out digit by digit, checking for overflow without a 64 bit divide.
+void CommandParser::add_to_field(char ch)
+{
+  const char kind = signature_[kind_];
+  if ((kind == WORD_ARG) || (kind == STRING_ARG)) {
+    if (text_used_ >= TEXT_SIZE - 1) {
+      fail(TOO_LONG);
+      return;
+    }
+    text_[text_used_++] = ch;
+    return;
+  }
+
+  if ((ch < '0') || (ch > '9')) {
+    fail(NON_DIGIT);
+    return;
+  }
+  const uint8_t digit = ch - '0';
+  // Both limits end in a 5.
+  const uint64_t tenth = (kind == WIDE_ARG) ? 1844674407370955161ULL : 429496729UL;
+  Field &field = fields_[count_];
+  if ((field.value > tenth) || ((field.value == tenth) && (digit > 5))) {
+    fail(OVERFLOW);
     return;
   }
+  field.value = field.value * 10 + digit;
+  digits_ = true;
+}
 
-  buffer_[last_char_pos] = ' ';
-  size_--;
 
-  if (cursor_ >= size_) {
-    error_ = EMPTY;
+void CommandParser::end_field(void)
+{
+  const char kind = signature_[kind_];
+  if ((kind == WORD_ARG) || (kind == STRING_ARG)) {
+    text_[text_used_++] = '\0';
+  } else if (!digits_) {
+    // Just a sign.
+    fail(NON_DIGIT);
     return;
   }
+  count_++;
+  kind_++;
+  state_ = BETWEEN;
+}
 
-  error_ = NONE;
+
+void CommandParser::end_line(void)
+{
+  if (!error_ && (count_ < required_)) {
+    error_ = MISSING;
+  }
+  state_ = DONE;
 }
 
 
 bool CommandParser::check_complete()
 {
-  if (error_) {
-    return false;
-  }
-  skip_spaces();
-  if (cursor_ < size_) {
-    error_ = EXTRA;
-    return false;
-  }
+  return !error_;
+}
+
 
-  return true;
+bool CommandParser::has_more()
+{
+  return !error_ && (next_ < count_);
 }
 
 
-/// Read a single character.
-///
-/// Doesn't skip spaces.
-char CommandParser::get_char()
+/// The next field for get_word() and friends, or NULL (and the error flag
+/// set) if there are no more.
+const CommandParser::Field *CommandParser::next_field(void)
 {
-  const bool fault = prepare(false);
-  if (fault) {
-    return '\0';
+  if (error_) {
+    return NULL;
   }
-  return buffer_[cursor_++];
+  if (next_ >= count_) {
+    error_ = MISSING;
+    return NULL;
+  }
+  return &fields_[next_++];
 }
 
 
 const char *CommandParser::get_word()
 {
-  const bool fault = prepare(true);
-  if (fault) {
+  const Field *field = next_field();
+  if (!field) {
     return "";
   }
-  const char* start = buffer_ + cursor_;
-  while (buffer_[cursor_] != ' ') {
-    cursor_++;
-  }
-  buffer_[cursor_++] = '\0';
-  return start;
+  return &text_[field->text];
 }
 
 
 const char *CommandParser::get_string()
 {
-  const bool fault = prepare(false);
-  if (fault) {
-    return "";
-  }
-  const char* start = buffer_ + cursor_;
-  buffer_[size_] = '\0';
-  cursor_ = size_;
-  return start;
+  return get_word();
 }
 
 
 uint32_t CommandParser::get_uint32(uint32_t min, uint32_t max)
 {
-  const bool fault = prepare(true);
-  if (fault) {
+  const Field *field = next_field();
+  if (!field) {
     return 0;
   }
-  const uint32_t val = get_int();
-  if (error_) {
+  if ((field->value < min) || (field->value > max))
+  {
+    error_ = RANGE;
     return 0;
   }
-  if ((val < min) || (val > max))
+  return uint32_t(field->value);
+}
+
+
+/// As get_uint32(), for values that need more than 32 bits (such as wide event
+/// masks).
+uint64_t CommandParser::get_uint64(uint64_t min, uint64_t max)
+{
+  const Field *field = next_field();
+  if (!field) {
+    return 0;
+  }
+  if ((field->value < min) || (field->value > max))
   {
     error_ = RANGE;
     return 0;
   }
-  return val;
+  return field->value;
 }
 
 
-/// Read a signed integer from the string.
+/// Read a signed integer.
 ///
 /// If it is not in the specified range then return 0 and set the error
 /// flag.
 int32_t CommandParser::get_int32(int32_t min, int32_t max)
 {
-  const bool fault = prepare(true);
-  if (fault) {
+  const Field *field = next_field();
+  if (!field) {
     return 0;
   }
-  const char ch = peek();
-  if (ch == '-') {
-    get_char();
-    const uint32_t val = get_int();
+  const uint32_t val = uint32_t(field->value);
+  if (field->negative) {
     if ((min > 0) || (val > uint32_t(-(min + 10)) + 10) || ((max < 0) && (val < uint32_t(-max)))) {
       error_ = RANGE;
       return 0;
     }
-    return -int32_t(val);
-  }
-  if (ch == '+') {
-    get_char();
+    return int32_t(0 - val);
   }
-  const uint32_t val = get_int();
   if ((max < 0) || (val > uint32_t(max)) || ((min > 0) && (val < uint32_t(min)))) {
     error_ = RANGE;
     return 0;
   }
   return int32_t(val);
 }
-
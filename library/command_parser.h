@@ -1,6 +1,8 @@
 #ifndef COMMAND_PARSER_H
 #define COMMAND_PARSER_H
 
+#include "Arduino.h"
+
 enum {
   NONE,
   BAD_TERM = 't',  // The string is not terminated with a NL
@@ -9,46 +11,113 @@ enum {
   OVERFLOW = 'o',  // The integer has too macny digits
   NON_DIGIT = 'd', // What should be an integer has a wrong character
   RANGE = 'r',     // The integer is too bad or small
-  EXTRA = 'x'      // Extra characters at end of string
+  EXTRA = 'x',     // Extra characters at end of string
+  TOO_LONG = 'l'   // The text fields are too long to hold
+};
+
+/// The kinds of field a command can take.  A command's signature is a string
+/// of these, one per field; fields after a '?' may be left off.
+enum {
+  WORD_ARG = 'w',      // text up to the next space
+  STRING_ARG = 's',    // the rest of the line, spaces and all
+  UINT_ARG = 'u',      // unsigned integer, up to 32 bits
+  INT_ARG = 'i',       // integer with an optional sign, magnitude up to 32 bits
+  WIDE_ARG = 'U',      // unsigned integer, up to 64 bits
+  OPTIONAL_ARGS = '?'
 };
 
 /// Let's parse the command sent to the Logger from the management software.
 /// Unlike the Arduino Serial::parseInt() method and friends, CommandParser
 /// will communicate errors.
 ///
-/// It is instantiated with the incoming string.
+/// Characters are pushed in with add() as they arrive; nothing waits for the
+/// rest of the line.  The first (non space) character of a line is the
+/// command.  Once add() has returned COMMAND the command's signature is given
+/// to set_signature(), and the fields that follow are read as they arrive
+/// into values and (for text fields) a small text store.  Only these are
+/// kept, not the line, so lines can be any length.
 ///
-/// Note: that the string is modified by the object.
+/// When add() returns LINE the fields can be read, in order, with get_word()
+/// and friends, which check integers against the ranges given.  The fields
+/// stay until the next character is added.
 ///
 class CommandParser
 {
+  public:
+    static const uint8_t MAX_ARGS = 4;
+    static const uint8_t MAX_SIGNATURE = MAX_ARGS + 1;   // '?' included
+    static const uint8_t TEXT_SIZE = 64;
+
+    /// What add() has found.
+    enum {
+      MORE = 0,      // Nothing yet.
+      COMMAND = 1,   // The command character: call set_signature().
+      LINE = 2       // The end of the line: the fields can be read.
+    };
+
   private:
-    char *buffer_;
-    uint8_t size_;
-    uint8_t cursor_;
+    typedef struct {
+      uint64_t value;    // integers: the magnitude
+      bool negative;
+      uint8_t text;      // text fields: offset in text_
+    } Field;
+
+    enum {
+      START,    // skipping spaces before the command
+      BETWEEN,  // skipping spaces before a field
+      IN_FIELD,
+      IGNORE,   // skipping to the end of the line
+      DONE      // the line is complete
+    };
+
+    char signature_[MAX_ARGS + 1];   // without the '?'
+    Field fields_[MAX_ARGS];
+    char text_[TEXT_SIZE];
+    uint8_t state_;
+    char command_;
     char error_;
+    uint8_t kind_;       // position in signature_ of the field being read
+    uint8_t required_;   // fields needed
+    uint8_t count_;      // fields read
+    uint8_t next_;       // fields taken by get_word() and friends
+    uint8_t text_used_;
+    bool digits_;        // the field being read has a digit
 
-    char peek();
-    void skip_spaces();
-    uint32_t get_int(void);
-    bool prepare(bool skip_space);
+    void reset(void);
+    void fail(char error);
+    void start_field(char ch);
+    void add_to_field(char ch);
+    void end_field(void);
+    void end_line(void);
+    const Field *next_field(void);
 
   public:
 
-    /// Instantiate the object with the string to process, and its size.
-    CommandParser(char * buffer, uint8_t size);
+    CommandParser();
+
+    /// Pass in the next character received.  Returns COMMAND, LINE or MORE.
+    uint8_t add(char ch);
+
+    /// Say what fields the command takes (see WORD_ARG and friends).  NULL
+    /// means the command is unknown: the rest of the line is ignored.
+    void set_signature(const char *signature);
+
+    inline char command() const
+    {
+      return command_;
+    }
 
-    inline char error()
+    inline char error() const
     {
       return error_;
     }
 
+    /// True if there has been no error.
     bool check_complete();
 
-    /// Read a single character.
-    ///
-    /// Doesn't skip spaces.
-    char get_char();
+    /// True if there is another field to read, for commands with optional
+    /// trailing fields.
+    bool has_more();
 
     const char *get_word();
 
@@ -56,7 +125,9 @@ class CommandParser
 
     uint32_t get_uint32(uint32_t min=0, uint32_t max=0xFFFFFFFF);
 
-    /// Read a signed integer from the string.
+    uint64_t get_uint64(uint64_t min=0, uint64_t max=0xFFFFFFFFFFFFFFFF);
+
+    /// Read a signed integer.
     ///
     /// If it is not in the specified range then return 0 and set the error
     /// flag.
@@ -4,7 +4,13 @@
 #include "data_logger.h"
 #include "char_stream.h"
 #include "command_parser.h"
+#include "event_queue.h"
 #include "file_transfer.h"
+#include "log_buffer.h"
+#include "log_record.h"
+#include "time_index.h"
+#include "timestamp.h"
+#include "timing_histogram.h"
 #include "utils.h"
 
 
@@ -15,18 +21,44 @@ namespace coweeta {
 static const EventSchedule* _schedule;
 static uint8_t _num_events;
 
-// time of next event (since epoch)  TODO: change to since midnight.
+// time of next event (since epoch)
 static uint32_t _next_time;
 
-// Current time (since epoch)  TODO: change to since midnight.
+// Current time (since epoch)
 static uint32_t _now;
 
-static uint16_t _triggered_events;
-static uint16_t _forced_events;
+// The scheduler's clock: milliseconds since _ms_base (a midnight, in seconds
+// since epoch), which keeps the times of the queued events in 32 bits.
+// _now_ms and _next_ms are _now and _next_time on this clock, to the
+// millisecond; _next_ms is NO_EVENT if nothing is scheduled.  The base is
+// moved on a whole number of days once the clock passes REBASE_SECONDS, so
+// that a time MAX_INTERVAL_MS ahead of it still fits in 32 bits.
+static const uint32_t NO_EVENT = 0xFFFFFFFF;
+static const uint32_t SECONDS_PER_DAY = 86400UL;
+static const uint32_t REBASE_SECONDS = 0x80000000UL / 1000;
+static uint32_t _ms_base = 0;
+static uint32_t _now_ms;
+static uint32_t _next_ms = NO_EVENT;
+
+static event_mask_t _triggered_events;
+static event_mask_t _forced_events;
 static File log_file;
-static int file_number = 0;
+static uint32_t file_number = 0;
+
+// The number of the next log file is kept on the card, so that starting up
+// doesn't mean looking for each file name in turn.
+static const char NEXT_FILE_INDEX[] = "NEXTLOG.TXT";
+static uint32_t _next_file_number = 0;
 static File _download_file;
-static uint16_t _event_enabled = 0xFFFF;
+
+// The file being sent to the management software, if any.  A line of it is
+// sent on each pass round the wait loop, in between other work.
+static FileTransfer _transfer;
+static event_mask_t _event_enabled = ~event_mask_t(0);
+
+// Upcoming deadlines of the enabled events.  Kept up to date as events fire and
+// are enabled or disabled, so that finding the next one is cheap.
+static EventQueue _queue;
 
 // Arduino hardware pin addresses for indicator LEDs, the indicator buzzer and
 // the user control button.  Set on startup.
@@ -36,6 +68,13 @@ static uint8_t beeper_pin_ = 0;
 static uint8_t button_pin_ = 0;
 
 
+// While the management software is talking to us the board specific code
+// should sleep lightly enough for serial input to wake it.  The session lasts
+// this many seconds after the last command or button press.
+static const uint32_t USB_SESSION_LENGTH = 60;
+static uint32_t _usb_session_end = 0;
+static volatile bool _button_pressed = false;
+
 static uint8_t logger_cs_pin_ = 0;
 static uint32_t usb_usart_baud_rate_ = 0;
 
@@ -43,10 +82,88 @@ static uint32_t usb_usart_baud_rate_ = 0;
 static bool log_to_file_;
 static bool log_to_term_;
 
-// The buffer where log output is placed.
-static const int BUF_SIZE = 250;
-char char_buf[BUF_SIZE];
-CharStream char_stream(char_buf, BUF_SIZE);
+// Log line text, passed straight on to the log file's buffer and the serial
+// port.
+CharStream char_stream;
+
+// Text of the last timestamp written.
+static Timestamp _timestamp;
+
+// Binary log files: the record being built, and whether the file still needs
+// its header.  _text_line and _binary_line say which of char_stream and
+// _record the current log line is going to; _csv_line that the text is going
+// to the log file.
+static LogFormat _log_format = CsvLog;
+static LogRecord _record;
+static bool _header_pending = false;
+static bool _text_line = false;
+static bool _csv_line = false;
+static bool _binary_line = false;
+
+// Log file output is held here and flushed to the card as the policy says.
+static LogBuffer _log_buffer;
+
+// Where in the log file the records from each stretch of time are.
+static TimeIndex _time_index;
+static FlushPolicy _flush_policy = {0, 60, true};
+
+// Size to allocate new log files, or 0 to let them grow.
+static uint32_t _preallocation = 0;
+
+// When to move on to a new log file, and what has gone into the current one
+// so far, for its entry in the index.
+static RotationPolicy _rotation = {0, 0, NoPeriod};
+static uint32_t _file_records = 0;
+static uint32_t _file_first_time = 0;
+static uint32_t _file_last_time = 0;
+
+// When the log line being built was started.
+static uint32_t _line_time = 0;
+
+// Each log file, once finished with, gets a line here: its name, the times
+// of its first and last records and the number of records.  Only ever
+// appended to.
+static const char LOG_INDEX[] = "LOGINDEX.TXT";
+
+// Log lines written since start up, those that took more than one binary
+// record, and those with fields dropped for want of room (see the 'S'
+// command).
+static uint32_t _lines_logged = 0;
+static uint32_t _lines_continued = 0;
+static uint32_t _lines_cut_short = 0;
+
+// Aggregation (see DataLogger::set_aggregation()): the column aggregators,
+// the events that report them, whether the current log line's values are
+// going to them and the column the next value is for.
+static Aggregator *_aggregators = NULL;
+static uint8_t _num_aggregators = 0;
+static event_mask_t _report_events = 0;
+static bool _sampling = false;
+static uint8_t _column = 0;
+
+// Slots of each event that went by without it being run (see CatchUp), since
+// start up, for the 'w' command.  They stop at 65535.
+static uint16_t _missed[COWEETA_MAX_EVENTS];
+
+#if COWEETA_TIMING
+// Timings for the 'H' command.  For each event: how late it was handled, by
+// the scheduler's clock, and how long the sketch then took before calling
+// wait_for_event() again.  For the logger as a whole: each write to the card
+// (a sector of log lines), each flush of the log file, and each command from
+// the management software.
+typedef struct {
+  TimingHistogram lateness;
+  TimingHistogram handling;
+} EventTiming;
+
+static EventTiming _event_timing[COWEETA_MAX_EVENTS];
+static TimingHistogram _write_time;
+static TimingHistogram _flush_time;
+static TimingHistogram _command_time;
+static uint32_t _returned_us;  // when wait_for_event() last returned
+static bool _returned = false;
+static uint32_t _now_us;       // when _now_ms was read
+#endif
 
 static uint8_t sd_card_state_;
 
@@ -69,43 +186,207 @@ static void die(const char* error_str) {
 }
 
 
-// Returns the time that the specified event is due to occur.
+// Move the scheduler's clock base to the midnight the day before _now, and
+// the queued events' times with it.  Only set_time() moves the clock back
+// more than the day's margin, and it queues the events afresh.
+static void move_clock_base(void)
+{
+  const uint32_t base = (_now / SECONDS_PER_DAY - 1) * SECONDS_PER_DAY;
+  if (base > _ms_base) {
+    const uint32_t days = (base - _ms_base) / SECONDS_PER_DAY;
+    const uint32_t shift = (days < 49) ? days * SECONDS_PER_DAY * 1000 : 0xFFFFFFFF;
+    _queue.shift_back(shift);
+    if (_next_ms != NO_EVENT) {
+      _next_ms = (_next_ms > shift) ? _next_ms - shift : 0;
+    }
+  }
+  _ms_base = base;
+}
+
+
+// Read the time from the board: _now, and _now_ms on the scheduler's clock.
+static void update_now(void)
+{
+  uint16_t millisecond;
+  _now = _logger->get_unix_time_ms(millisecond);
+#if COWEETA_TIMING
+  _now_us = micros();
+#endif
+  if ((_now < _ms_base) || (_now - _ms_base >= REBASE_SECONDS)) {
+    move_clock_base();
+  }
+  _now_ms = (_now - _ms_base) * 1000 + millisecond;
+}
+
+
+// Returns the time (on the scheduler's clock) of the specified event's first
+// slot after now.  The slots are counted from the epoch, so the phase of the
+// clock's base within the interval is worked out first.
 static uint32_t next_time_for_event(const EventSchedule* schedule)
 {
-  const int16_t interval = schedule->interval;
-  const int16_t offset = schedule->offset;
-  const int32_t next = (((_now - offset) / interval) + 1) * interval + offset;
-  return next;
+  const int32_t interval = schedule->interval_ms;
+  int32_t phase = (int64_t(_ms_base) * 1000 - schedule->offset_ms) % interval;
+  if (phase < 0) {
+    phase += interval;
+  }
+  return ((_now_ms + phase) / interval + 1) * interval - phase;
+}
+
+
+// Rebuilds the event queue from scratch, for when the schedule is set or the
+// clock is changed.
+static void queue_all_events()
+{
+  _queue.clear();
+  for (uint8_t i = 0; i < _num_events; i++) {
+    if (_event_enabled & event_bit(i)) {
+      _queue.insert(i, next_time_for_event(&_schedule[i]));
+    }
+  }
+}
+
+
+// Brings the event queue in line with a new set of enabled events.  Only the
+// events whose state changes are touched.
+static void set_enabled_events(event_mask_t events)
+{
+  const event_mask_t changed = events ^ _event_enabled;
+  _event_enabled = events;
+  for (uint8_t i = 0; i < _num_events; i++) {
+    const event_mask_t mask = event_bit(i);
+    if (changed & mask) {
+      if (events & mask) {
+        _queue.insert(i, next_time_for_event(&_schedule[i]));
+      } else {
+        _queue.remove(i);
+      }
+    }
+  }
+}
+
+
+// Write the binary log file's header, if it hasn't been yet, at the start of
+// the record begun with _record.begin().  Where logging carries on in an
+// existing file it follows a zero length byte.
+static void write_pending_header(void)
+{
+  if (!_header_pending) {
+    return;
+  }
+  const bool appending = _log_buffer.length() != 0;
+  _time_index.note_header(_log_buffer.length() + (appending ? 1 : 0));
+  _record.write_header(_log_buffer, appending, _flush_policy, _schedule, _num_events);
+  _header_pending = false;
+}
+
+
+// Note in the log file that count slots of the event, the first at the given
+// time (seconds since epoch), went by without it being run.  A CSV file gets a
+// comment line, which readers of the data skip; a binary file a gap record
+// (see log_record.h).
+static void write_gap(uint8_t event, uint16_t count, uint32_t first)
+{
+  if (!log_to_file_) {
+    return;
+  }
+  if (_log_format == BinaryLog) {
+    if (_header_pending) {
+      _record.begin(_now);
+      write_pending_header();
+    }
+    _record.write_gap(_log_buffer, event, count, first);
+  } else {
+    _timestamp.update(first);
+    _log_buffer.print("# missed ");
+    _log_buffer.print(_schedule[event].name);
+    _log_buffer.print(' ');
+    _log_buffer.print(count);
+    _log_buffer.print(" from ");
+    _log_buffer.write(_timestamp.text(), Timestamp::LENGTH);
+    _log_buffer.print('\n');
+  }
+  // A line for the flush policy, as log lines are.
+  _log_buffer.end_line(_now);
+}
+
+
+// Deal with the events whose slots went by before they could be run, as
+// their CatchUp policies say.  A slot is missed once it is a second late, or
+// an interval if that is shorter.  An event left with a slot in the past is
+// run late: wait_for_event() returns at once for it.  Doing this again
+// changes nothing, so the slots are only counted as missed once.
+static void catch_up(void)
+{
+  for (uint8_t i = 0; i < _num_events; i++) {
+    const uint32_t due = _queue.due(i);
+    const uint32_t interval = _schedule[i].interval_ms;
+    const uint32_t grace = (interval < 1000) ? interval : 1000;
+    if ((due == NO_EVENT) || (due + grace > _now_ms)) {
+      continue;
+    }
+    // The slots from due on that are at least grace late.
+    const uint32_t slots = (_now_ms - grace - due) / interval + 1;
+    uint32_t missed;
+    switch (_schedule[i].catch_up) {
+      case RunEachMissed:
+        continue;
+
+      case RunOnceLate:
+        missed = slots - 1;
+        _queue.insert(i, due + missed * interval);
+        break;
+
+      default:
+        missed = slots;
+        _queue.insert(i, due + slots * interval);
+        break;
+    }
+    if (missed) {
+      const uint16_t count = (missed < 0xFFFF) ? missed : 0xFFFF;
+      _missed[i] = (_missed[i] < 0xFFFF - count) ? _missed[i] + count : 0xFFFF;
+      write_gap(i, count, _ms_base + due / 1000);
+    }
+  }
 }
 
 
-// Looks at the list of scheduled events and determines which ones are due next
+// Looks at the queue of scheduled events and determines which ones are due next
 // and what that time is.  Sets the file scope variables _next_time and
 // _triggered_events.
 //
+// Events are moved on to their next slot as they are run (see
+// wait_for_event()), so any left with a slot in the past missed it, and are
+// caught up with first.  Their next time may then be in the past too, for
+// them to run late.
+//
 // If _forced_events is set then nothing is done: _next_time and
 // _triggered_events will already have been set.
 //
-// If no events are scheduled then _next_time is set to 0xFFFFFFFF
+// The time is worked out to the millisecond (_next_ms), and in the seconds
+// since epoch that it falls in (_next_time).  If no events are scheduled then
+// _next_ms is NO_EVENT and _next_time is set to 0xFFFFFFFF
 static void compute_next_time()
 {
   if (_forced_events) {
       return;
   }
 
-  _next_time = 0xFFFFFFFF;
-  _triggered_events = 0x0000;
-  uint16_t mask = 0x0001;
-  for (uint8_t i = 0; i < _num_events; i++, mask <<= 1) {
-    if ((_event_enabled & mask) != 0) {
-      const uint32_t candidate = next_time_for_event(&_schedule[i]);
-      if (candidate < _next_time) {
-        _next_time = candidate;
-        _triggered_events = mask;
-      } else if (candidate == _next_time) {
-        _triggered_events |= mask;
-      }
-    }
+  if (_queue.top_time() < _now_ms) {
+    catch_up();
+  }
+
+  _next_ms = _queue.top_time();
+  _next_time = (_next_ms == NO_EVENT) ? 0xFFFFFFFF : _ms_base + _next_ms / 1000;
+  _triggered_events = _queue.events_at(_next_ms);
+}
+
+
+// The events due at _next_ms are about to be run: move each on to its next
+// slot.
+static void move_on_triggered_events()
+{
+  while (_queue.top_time() == _next_ms) {
+    _queue.reschedule_top(_next_ms + _schedule[_queue.top_event()].interval_ms);
   }
 }
 
@@ -149,20 +430,100 @@ static void report_error(const CommandParser &parser)
 }
 
 
-uint16_t get_next_file_number(void) {
-  for (uint16_t file_num = 0; file_num < 1000; file_num++) {
-    const char *filename = build_filename(file_num);
-    if (!sd_card_.exists(filename)) {
-      return file_num;
+// One pass through the directory for the highest numbered log file.
+static uint32_t scan_for_next_file_number(void)
+{
+  uint32_t next = 0;
+  File dir = sd_card_.open("/");
+  dir.rewindDirectory();
+  while (true) {
+    File entry = dir.openNextFile();
+    if (!entry) {
+      break;
+    }
+    char name[13];
+    if (entry.getName(name, sizeof(name))) {
+      const int32_t file_num = parse_filename(name);
+      if ((file_num >= 0) && (uint32_t(file_num) >= next)) {
+        next = file_num + 1;
+      }
+    }
+    entry.close();
+  }
+  dir.close();
+  return next;
+}
+
+
+// The number in the index file, if there is one that makes sense.
+static bool read_next_file_number(uint32_t &next)
+{
+  File index = sd_card_.open(NEXT_FILE_INDEX);
+  if (!index) {
+    return false;
+  }
+  char text[8];
+  const int len = index.read(text, sizeof(text));
+  index.close();
+  next = 0;
+  for (int i = 0; i < len; i++) {
+    if (text[i] == '\n') {
+      return i > 0;
     }
+    if ((text[i] < '0') || (text[i] > '9') || (next > MAX_FILE_NUMBER)) {
+      return false;
+    }
+    next = next * 10 + (text[i] - '0');
+  }
+  return false;
+}
+
+
+// Written in place, so the file never changes size.
+static void write_next_file_number(uint32_t next)
+{
+  File index = sd_card_.open(NEXT_FILE_INDEX, FILE_WRITE);
+  if (!index) {
+    // The directory scan will have to do next time.
+    return;
+  }
+  char text[] = "00000\n";
+  for (int8_t i = 4; i >= 0; i--) {
+    text[i] = next % 10 + '0';
+    next /= 10;
+  }
+  index.seek(0);
+  index.write(text, sizeof(text) - 1);
+  index.close();
+}
+
+
+static bool log_file_exists(uint32_t file_num)
+{
+  return sd_card_.exists(build_filename(file_num)) || sd_card_.exists(build_filename(file_num, true));
+}
+
+
+// The index is stale if the file it names is already there (say the card has
+// been in another logger, or an older file follows a gap), in which case the
+// directory is scanned for a number past all of them.  Checked at every new
+// file, so a file is never written over.
+uint32_t get_next_file_number(void) {
+  uint32_t next;
+  if (!read_next_file_number(next) || log_file_exists(next)) {
+    next = scan_for_next_file_number();
+  }
+  if (next > MAX_FILE_NUMBER) {
+    die("Ran out of filenames.");
   }
-  die("Ran out of filenames.");
+  _next_file_number = next;
+  return next;
 }
 
 
-File open_log_file(uint16_t file_num, int mode)
+File open_log_file(uint32_t file_num, int mode)
 {
-  const char *filename = build_filename(file_num);
+  const char *filename = build_filename(file_num, _log_format == BinaryLog);
   File log_file = sd_card_.open(filename, mode);
   if (!log_file) {
     die("Couldn't create file.");
@@ -171,21 +532,244 @@ File open_log_file(uint16_t file_num, int mode)
 }
 
 
+// Start a new log file.  Text files get their comment lines straight away;
+// binary files get their header with the first record, once the schedule is
+// known.
+//
+// The flush policy is recorded so that anyone reading the file after a power
+// failure knows how much may have been lost from the end.
+static void start_log_file(uint32_t file_num)
+{
+  const char *filename = build_filename(file_num, _log_format == BinaryLog);
+  uint32_t first_block;
+  uint32_t last_block;
+  if (_preallocation && log_file.createContiguous(filename, _preallocation) &&
+      log_file.contiguousRange(&first_block, &last_block)) {
+    // Clear out whatever was there before, so the end of the log is plain.
+    sd_card_.card()->erase(first_block, last_block);
+    _log_buffer.attach_contiguous(log_file, sd_card_.card(), first_block, last_block);
+  } else {
+    log_file = open_log_file(file_num, FILE_WRITE);
+    _log_buffer.attach(log_file);
+  }
+  file_number = file_num;
+  _file_records = 0;
+  _time_index.start(sd_card_, filename);
+  if (file_num >= _next_file_number) {
+    _next_file_number = file_num + 1;
+    write_next_file_number(_next_file_number);
+  }
+  if (_log_format == BinaryLog) {
+    _header_pending = true;
+    return;
+  }
+  _log_buffer.print("# Coweeta log file\n");    //TEMP!!!
+  _log_buffer.print("# flush lines=");
+  _log_buffer.print(_flush_policy.lines);
+  _log_buffer.print(" seconds=");
+  _log_buffer.print(_flush_policy.seconds);
+  _log_buffer.print(" power_down=");
+  _log_buffer.print(_flush_policy.before_power_down);
+  _log_buffer.print('\n');
+  _log_buffer.flush();
+}
+
+
+// Add the log file to the index, unless nothing was logged to it.
+static void add_to_index(void)
+{
+  if (!_file_records) {
+    return;
+  }
+  File index = sd_card_.open(LOG_INDEX, FILE_WRITE);
+  if (!index) {
+    return;
+  }
+  index.print(build_filename(file_number, _log_format == BinaryLog));
+  index.print(',');
+  index.print(_file_first_time);
+  index.print(',');
+  index.print(_file_last_time);
+  index.print(',');
+  index.print(_file_records);
+  index.print('\n');
+  index.close();
+}
+
+
+// Make the log lines so far safe on the card, and where they are.
+static void flush_log_file(void)
+{
+#if COWEETA_TIMING
+  const uint32_t start_us = micros();
+#endif
+  _log_buffer.flush();
+  _time_index.flush();
+#if COWEETA_TIMING
+  _flush_time.add_since(start_us);
+#endif
+}
+
+
+// Finish with the log file.
+static void close_log_file(void)
+{
+  _time_index.flush();
+  _log_buffer.finish();
+  log_file.close();
+  add_to_index();
+}
+
+
+// The day, or week (starting on a Monday), that the time falls in.
+static uint32_t rotation_period_of(uint32_t time)
+{
+  const uint32_t day = time / 86400UL;
+  // 1970-01-01 was a Thursday.
+  return (_rotation.period == Weekly) ? (day + 3) / 7 : day;
+}
+
+
+// Whether a record made at the given time should start a new log file.
+static bool rotation_due(uint32_t time)
+{
+  if (!_file_records || (_next_file_number > MAX_FILE_NUMBER)) {
+    return false;
+  }
+  return (_rotation.bytes && (_log_buffer.length() >= _rotation.bytes)) ||
+         (_rotation.records && (_file_records >= _rotation.records)) ||
+         ((_rotation.period != NoPeriod) && (rotation_period_of(time) != rotation_period_of(_file_first_time)));
+}
+
+
+// A record made at the given time is about to go into the log file.  A
+// binary record's entry gets the time its time step counts from, which is
+// the base time of the header if it comes under a fresh one.
+static void index_record(uint32_t time)
+{
+  uint32_t previous;
+  if (_log_format == BinaryLog) {
+    previous = _header_pending ? time : _record.last_time();
+  } else {
+    previous = _file_records ? _file_last_time : time;
+  }
+  _time_index.add_record(_log_buffer.length(), previous);
+}
+
+
+// A record made at the given time has gone into the log file.
+static void note_record(uint32_t time)
+{
+  if (!_file_records) {
+    _file_first_time = time;
+  }
+  _file_last_time = time;
+  _file_records++;
+}
+
+
+// Give the next value of the log line to its column's aggregator.
+static void add_sample(double value)
+{
+  if (_column < _num_aggregators) {
+    _aggregators[_column].add(value);
+  }
+  _column++;
+}
+
+
+// Log a line of the aggregators' summaries, and start them afresh.
+static void write_summaries(void)
+{
+  Aggregator *const columns = _aggregators;
+  // Let the values through to the log.
+  _aggregators = NULL;
+  _logger->new_log_line();
+  for (uint8_t i = 0; i < _num_aggregators; i++) {
+    columns[i].log_to(*_logger);
+    columns[i].reset();
+  }
+  _logger->end_log_line();
+  _aggregators = columns;
+}
+
+
+#if COWEETA_TIMING
+// The events last returned by wait_for_event() have been handled.
+static void time_handling(void)
+{
+  if (!_returned) {
+    return;
+  }
+  const uint32_t us = micros() - _returned_us;
+  for (uint8_t i = 0; i < _num_events; i++) {
+    if (_triggered_events & event_bit(i)) {
+      _event_timing[i].handling.add(us);
+    }
+  }
+}
+
+
+// The scheduled events are about to be returned by wait_for_event(), having
+// been found due at _now_ms.
+static void time_lateness(void)
+{
+  const uint32_t ms = _now_ms - _next_ms;
+  const uint32_t us = (ms < 4000000UL) ? ms * 1000 + (micros() - _now_us) : 0xFFFFFFFF;
+  for (uint8_t i = 0; i < _num_events; i++) {
+    if (_triggered_events & event_bit(i)) {
+      _event_timing[i].lateness.add(us);
+    }
+  }
+}
+#endif
+
+
+static void count_line(bool continued, bool cut_short)
+{
+  _lines_logged++;
+  if (continued) {
+    _lines_continued++;
+  }
+  if (cut_short) {
+    _lines_cut_short++;
+  }
+}
+
+
+// Flush the buffered log lines if there are enough of them, or they have
+// waited long enough.
+static void check_flush(void)
+{
+  const uint8_t lines = _log_buffer.lines_unflushed();
+  if (!lines) {
+    return;
+  }
+  if ((_flush_policy.lines && (lines >= _flush_policy.lines)) ||
+      (_flush_policy.seconds && (_now - _log_buffer.oldest_unflushed() >= _flush_policy.seconds))) {
+    flush_log_file();
+  }
+}
+
+
 // The management software is trying to either enable/disable particular events,
 // or it is trying to force some events to trigger immediately.  (Determined
 // by whether event_bits is a reference to _triggered_events or _forced_events.
 //
 // If the command is bad (e.g. the event mask passed is too big) then the
-// routine returns false and an error is reported back up the USB.
+// routine returns false, and the parser's error is reported back up the USB.
 // Otherwise the appropriate flag variable is set.
-static bool set_event_bits(CommandParser &parser, uint16_t &event_bits)
+static bool set_event_bits(CommandParser &parser, event_mask_t &event_bits)
 {
   // trigger_event()
-  const uint16_t max_event_val = (1 << _num_events) - 1;
-  const uint16_t events = parser.get_uint32(0, max_event_val);
+  const event_mask_t max_event_val = event_bits_below(_num_events);
+#if COWEETA_MAX_EVENTS > 32
+  const event_mask_t events = parser.get_uint64(0, max_event_val);
+#else
+  const event_mask_t events = parser.get_uint32(0, max_event_val);
+#endif
   const bool okay = parser.check_complete();
   if (!okay) {
-    report_error(parser);
     return false;
   }
   event_bits = events;
@@ -206,33 +790,146 @@ static void manual_event_trigger(CommandParser &parser)
 // as determine by the event mask.
 static void event_enabling(CommandParser &parser)
 {
-  if (set_event_bits(parser, _event_enabled)) {
+  event_mask_t events;
+  if (set_event_bits(parser, events)) {
+     set_enabled_events(events);
      Serial.print("E\n");
   }
 }
 
 
-// Transfer a file from the SD card up the USB to the management software.
+// The number of bytes of the file that can be read: for the active log file
+// only the part in use.  Also makes sure that the file on the card is up to
+// date, as the active log file may have been written behind the file system's
+// back.
+static uint32_t file_limit(const char *filename)
+{
+  flush_log_file();
+  sd_card_.cacheClear();
+  if (strcasecmp(filename, build_filename(file_number, _log_format == BinaryLog)) == 0) {
+    return _log_buffer.length();
+  }
+  return 0xFFFFFFFF;
+}
+
+
+// Read the optional range (offset and count) following a file name.
+static void get_range(CommandParser &parser, uint32_t &offset, uint32_t &count)
+{
+  offset = 0;
+  count = 0xFFFFFFFF;
+  if (parser.has_more()) {
+    offset = parser.get_uint32();
+    if (parser.has_more()) {
+      count = parser.get_uint32();
+    }
+  }
+}
+
+
+// Transfer a file from the SD card up the USB to the management software,
+// as lines ('G') or in blocks ('B'), optionally only a range of it.
 // Immediately send the file size (in bytes), and then start the transfer
-// operation.
-//TODO: Currently the datalogger is locked until the file is sent.  Change this so that it can continue in the background.
-static void file_transfer(CommandParser &parser)
+// operation.  The file itself is sent by DataLogger::wait_for_event() as time
+// allows, so logging carries on while it goes.
+static void file_transfer(CommandParser &parser, char command)
 {
   const char *filename = parser.get_word();
+  uint32_t offset, count;
+  get_range(parser, offset, count);
   const bool okay = parser.check_complete();
   if (!okay) {
-    report_error(parser);
     return;
   }
-  FileTransfer ft = FileTransfer(sd_card_, filename);
-  Serial.print("G");
-  Serial.print(ft.file_size());
+  const uint32_t limit = file_limit(filename);
+  _transfer.abort();
+  _transfer.start(sd_card_, filename, limit, command == 'B');
+  _transfer.set_range(offset, count);
+  Serial.print(command);
+  Serial.print(_transfer.file_size());
   Serial.print("\n");
-  while (! ft.finished()) {
-    ft.transfer_line();
+}
+
+
+static void line_download(CommandParser &parser)
+{
+  file_transfer(parser, 'G');
+}
+
+
+static void block_download(CommandParser &parser)
+{
+  file_transfer(parser, 'B');
+}
+
+
+// Send the part of a log file that holds the records from a stretch of time
+// (found with its time index), in blocks as for 'B'.  The reply gives the
+// offset and length of that part, and (for a binary log) the time that its
+// first record's time step counts from and the offset of the header it comes
+// under.
+// Stop the download in progress, if any.
+static void stop_download(CommandParser &parser)
+{
+  const bool okay = parser.check_complete();
+  if (!okay) {
+    return;
+  }
+  _transfer.abort();
+  Serial.print("K\n");
+}
+
+
+static void time_range_download(CommandParser &parser)
+{
+  const char *filename = parser.get_word();
+  const uint32_t from = parser.get_uint32();
+  const uint32_t to = parser.get_uint32();
+  const bool okay = parser.check_complete();
+  if (!okay) {
+    return;
+  }
+  const uint32_t limit = file_limit(filename);
+  uint32_t offset, count, base_time, header_offset;
+  TimeIndex::find(sd_card_, filename, from, to, offset, count, base_time, header_offset);
+  _transfer.abort();
+  _transfer.start(sd_card_, filename, limit, true);
+  _transfer.set_range(offset, count);
+  const uint32_t size = _transfer.file_size();
+  const uint32_t left = offset < size ? size - offset : 0;
+  Serial.print('Q');
+  Serial.print(offset);
+  Serial.print(' ');
+  Serial.print(count < left ? count : left);
+  Serial.print(' ');
+  Serial.print(base_time);
+  Serial.print(' ');
+  Serial.print(header_offset);
+  Serial.print('\n');
+}
+
+
+// Send the CRC of a range of a file, and the number of bytes it covers.
+static void file_checksum(CommandParser &parser)
+{
+  const char *filename = parser.get_word();
+  uint32_t offset, count;
+  get_range(parser, offset, count);
+  const bool okay = parser.check_complete();
+  if (!okay) {
+    return;
   }
+  const uint32_t limit = file_limit(filename);
+  uint16_t crc;
+  const uint32_t covered = FileTransfer::checksum(sd_card_, filename, offset, count, limit, crc);
+  Serial.print("C");
+  Serial.print(crc);
+  Serial.print(" ");
+  Serial.print(covered);
+  Serial.print("\n");
 }
 
+
 // Remove the named file from the SD card.
 //TODO: error checking on operation.
 static void file_delete(CommandParser &parser)
@@ -240,157 +937,364 @@ static void file_delete(CommandParser &parser)
   const char *filename = parser.get_word();
   const bool okay = parser.check_complete();
   if (!okay) {
-    report_error(parser);
     return;
   }
   sd_card_.remove(filename);
+  if (parse_filename(filename) >= 0) {
+    // The log's time index is no use without it.
+    sd_card_.remove(TimeIndex::index_filename(filename));
+  }
   Serial.print("R\n");
 }
 
 
-// We believe a command has arrived from the management software.  Parse it and
-// act on it.
-static void process_command(void)
+// Echo (or not) log lines to the management software.
+static void set_output_mode(CommandParser &parser)
 {
-  const size_t BUF_SIZE = 100;  //TODO: yuck
-  char buffer[BUF_SIZE];
-  const size_t size = Serial.readBytes(buffer, BUF_SIZE);
+  const uint8_t mode = parser.get_uint32(0, 3);
+  const bool okay = parser.check_complete();
+  if (!okay) {
+    return;
+  }
+  log_to_term_ = mode == 1;
+  Serial.print("o\n");
+}
 
-  CommandParser parser = CommandParser(buffer, size);
-  const int command = parser.get_char();
 
-  if (parser.error()) {
-    report_error(parser);
+// new_active_file(): switch to a new file
+static void new_active_file(CommandParser &parser)
+{
+  const uint32_t file_num = parser.get_uint32(0, MAX_FILE_NUMBER);
+  const bool okay = parser.check_complete();
+  if (!okay) {
     return;
   }
+  close_log_file();
+  start_log_file(file_num);
 
-  switch(command) {
-    case 'e':
-      manual_event_trigger(parser);
-      return;
+  Serial.print("N\n");
+}
 
-    case 'E':
-      event_enabling(parser);
-      return;
 
-    case 'G':
-      file_transfer(parser);
-      return;
+// set time for sync_time()
+static void set_time(CommandParser &parser)
+{
+  const int32_t seconds = parser.get_int32(0, 0x7FFFFFFF);
+  const bool okay = parser.check_complete();
+  if (!okay) {
+    return;
+  }
+  _logger->set_unix_time(seconds);
+  update_now();
+  queue_all_events();
+  Serial.print("s\n");
+}
 
-    case 'o':
-      {
-        const uint8_t mode = parser.get_uint32(0, 3);
-        const bool okay = parser.check_complete();
-        if (!okay) {
-          report_error(parser);
-          return;
-        }
-        log_to_term_ = mode == 1;
-        Serial.print("o\n");
-      }
-      return;
 
-    case 'R':
-      file_delete(parser);
-      return;
+// How many log lines have been written since start up, how many of those
+// were too long for one binary record, and how many had fields dropped.
+static void send_log_stats(CommandParser &)
+{
+  Serial.print('S');
+  Serial.print(_lines_logged);
+  Serial.print(' ');
+  Serial.print(_lines_continued);
+  Serial.print(' ');
+  Serial.print(_lines_cut_short);
+  Serial.print('\n');
+}
 
-    case 'N':
-      {
-        // new_active_file() switch to new file
-        //TODO: split out
-        const uint8_t file_num = parser.get_uint32(0, 99);
-        const bool okay = parser.check_complete();
-        if (!okay) {
-          report_error(parser);
-          return;
-        }
-        log_file.close();
-        log_file = open_log_file(file_num, FILE_WRITE);
-        log_file.print("# Coweeta log file\n");    //TEMP!!!
-        log_file.flush();
 
-        Serial.print("N\n");
-      }
-      return;
+#if COWEETA_TIMING
+static void print_timing(const char *name, const TimingHistogram &histogram)
+{
+  Serial.print("H ");
+  Serial.print(name);
+  histogram.print(Serial);
+  Serial.print('\n');
+}
 
-    case 's':
-      {
-        //TODO: split out
-        // set time for sync_time()
-        const int32_t seconds = parser.get_int32(0, 0x7FFFFFFF);
-        const bool okay = parser.check_complete();
-        if (!okay) {
-          report_error(parser);
-          return;
-        }
-        _logger->set_unix_time(seconds);
-        Serial.print("s\n");
-      }
-      return;
 
-    default:
-      break;
-  }
+static void print_event_timing(const char *name, uint8_t event, const TimingHistogram &histogram)
+{
+  Serial.print("H ");
+  Serial.print(name);
+  Serial.print(' ');
+  Serial.print(event);
+  histogram.print(Serial);
+  Serial.print('\n');
+}
+
 
-  // The remaining commands take no args.
+// Send the timing histograms, and clear them if asked.
+static void send_timing(CommandParser &parser)
+{
+  const bool clear = parser.has_more() && parser.get_uint32();
   const bool okay = parser.check_complete();
   if (!okay) {
-    report_error(parser);
     return;
   }
+  print_timing("write", _write_time);
+  print_timing("flush", _flush_time);
+  print_timing("command", _command_time);
+  for (uint8_t i = 0; i < _num_events; i++) {
+    print_event_timing("late", i, _event_timing[i].lateness);
+    print_event_timing("run", i, _event_timing[i].handling);
+  }
+  Serial.print("H\n");
+  if (clear) {
+    _write_time.clear();
+    _flush_time.clear();
+    _command_time.clear();
+    for (uint8_t i = 0; i < _num_events; i++) {
+      _event_timing[i].lateness.clear();
+      _event_timing[i].handling.clear();
+    }
+  }
+}
+#endif
 
-  switch(command) {
-  case 'v':
-    // protocol version
-    Serial.print("v COW0.0\n");
-    return;
 
-  case 'A':
-    // get_active_file_num()
-    Serial.print("A");
-    Serial.print(file_number, DEC);
-    Serial.print('\n');
+// protocol version
+static void send_version(CommandParser &)
+{
+  Serial.print("v COW0.0\n");
+}
 
-    break;
 
-  case 'n':
-    // list event names
-    Serial.print("n ");
-    for (uint8_t i = 0; i < _num_events; i++) {
-      Serial.print(_schedule[i].name);
-      Serial.print(" ");
-    }
-    Serial.print("\n");
+// Mark the end of the replies to the commands before it, so that the
+// management software can send several commands at once and still tell whose
+// replies are whose.
+static void send_sequence(CommandParser &parser)
+{
+  const uint32_t sequence = parser.get_uint32();
+  const bool okay = parser.check_complete();
+  if (!okay) {
     return;
+  }
+  Serial.print('@');
+  Serial.print(sequence);
+  Serial.print('\n');
+}
 
-  case 't':
-    // get time for sync_time()
-    Serial.print("t");
-    Serial.print(_now, DEC);
-    Serial.print('\n');
 
-    return;
+// get_active_file_num()
+static void send_active_file(CommandParser &)
+{
+  Serial.print("A");
+  Serial.print(file_number, DEC);
+  Serial.print(' ');
+  Serial.print(build_filename(file_number, _log_format == BinaryLog));
+  Serial.print('\n');
+}
+
+
+// list event names
+static void send_event_names(CommandParser &)
+{
+  Serial.print("n ");
+  for (uint8_t i = 0; i < _num_events; i++) {
+    Serial.print(_schedule[i].name);
+    Serial.print(" ");
+  }
+  Serial.print("\n");
+}
+
+
+// get time for sync_time()
+static void send_time(CommandParser &)
+{
+  Serial.print("t");
+  Serial.print(_now, DEC);
+  Serial.print('\n');
+}
+
 
-  case 'L':
-    // list_files()
-    print_root_directory(sd_card_);
+// Send the index entry of each log file holding records from the given
+// stretch of time (every file, without one), the active file's last.
+static void send_index(CommandParser &parser)
+{
+  const uint32_t from = parser.has_more() ? parser.get_uint32() : 0;
+  const uint32_t to = parser.has_more() ? parser.get_uint32() : 0xFFFFFFFF;
+  const bool okay = parser.check_complete();
+  if (!okay) {
     return;
+  }
+  File index = sd_card_.open(LOG_INDEX);
+  if (index) {
+    // name,first,last,records
+    char line[48];
+    uint8_t len = 0;
+    int ch;
+    while ((ch = index.read()) >= 0) {
+      if (ch != '\n') {
+        if (len < sizeof(line) - 1) {
+          line[len++] = ch;
+        }
+        continue;
+      }
+      line[len] = '\0';
+      len = 0;
+      const char *first = strchr(line, ',');
+      const char *last = first ? strchr(first + 1, ',') : NULL;
+      if (last && (strtoul(first + 1, NULL, 10) <= to) && (strtoul(last + 1, NULL, 10) >= from)) {
+        Serial.print("I ");
+        Serial.print(line);
+        Serial.print('\n');
+      }
+    }
+    index.close();
+  }
+  if (_file_records && (_file_first_time <= to) && (_file_last_time >= from)) {
+    Serial.print("I ");
+    Serial.print(build_filename(file_number, _log_format == BinaryLog));
+    Serial.print(',');
+    Serial.print(_file_first_time);
+    Serial.print(',');
+    Serial.print(_file_last_time);
+    Serial.print(',');
+    Serial.print(_file_records);
+    Serial.print('\n');
+  }
+  Serial.print("I\n");
+}
 
-  case 'w':
-    // report wait for next event
-    Serial.print('w');
-    Serial.print(_next_time - _now);
-    Serial.print(' ');
-    Serial.print(_triggered_events);
+
+// list_files()
+static void list_files(CommandParser &)
+{
+  _log_buffer.flush();
+  print_root_directory(sd_card_);
+}
+
+
+// report wait for next event, and the slots each event has missed
+static void send_wait(CommandParser &)
+{
+  Serial.print('w');
+  Serial.print(_next_time - _now);
+  Serial.print(' ');
+  print_event_mask(Serial, _triggered_events);
+  Serial.print(' ');
+  print_event_mask(Serial, _event_enabled);
+  for (uint8_t i = 0; i < _num_events; i++) {
     Serial.print(' ');
-    Serial.print(_event_enabled);
-    Serial.print('\n');
-    return;
+    Serial.print(_missed[i]);
+  }
+  Serial.print('\n');
+}
 
-  default:
+
+// Event masks are read as wide as they can be.
+#if COWEETA_MAX_EVENTS > 32
+#define MASK_ARG "U"
+#else
+#define MASK_ARG "u"
+#endif
+
+// The commands of the management protocol (see doc/protocol.rst), with the
+// fields each takes.  Kept in flash on the AVR.
+static const CommandEntry _commands[] PROGMEM = {
+  {'@', "u", send_sequence},
+  {'A', "", send_active_file},
+  {'B', "w?uu", block_download},
+  {'C', "w?uu", file_checksum},
+  {'e', MASK_ARG, manual_event_trigger},
+  {'E', MASK_ARG, event_enabling},
+  {'G', "w?uu", line_download},
+#if COWEETA_TIMING
+  {'H', "?u", send_timing},
+#endif
+  {'I', "?uu", send_index},
+  {'K', "", stop_download},
+  {'L', "", list_files},
+  {'n', "", send_event_names},
+  {'N', "u", new_active_file},
+  {'Q', "wuu", time_range_download},
+  {'o', "u", set_output_mode},
+  {'R', "w", file_delete},
+  {'s', "i", set_time},
+  {'S', "", send_log_stats},
+  {'t', "", send_time},
+  {'v', "", send_version},
+  {'w', "", send_wait}
+};
+
+static_assert(sizeof(_commands[0].args) == CommandParser::MAX_SIGNATURE + 1,
+              "CommandEntry::args doesn't fit CommandParser::MAX_SIGNATURE");
+
+// Further commands added by the sketch (see DataLogger::add_commands()).
+static const CommandEntry *_sketch_commands = NULL;
+static uint8_t _num_sketch_commands = 0;
+
+// Commands from the management software are parsed as they arrive.
+static CommandParser _parser;
+static CommandEntry _entry;
+static bool _known_command;
+
+
+// Find the entry for the command.  The protocol's own commands come first, so
+// a sketch can't take them over.
+static bool find_command(char command, CommandEntry &entry)
+{
+  for (uint8_t i = 0; i < sizeof(_commands) / sizeof(_commands[0]); i++) {
+    memcpy_P(&entry, &_commands[i], sizeof(entry));
+    if (entry.command == command) {
+      return true;
+    }
+  }
+  for (uint8_t i = 0; i < _num_sketch_commands; i++) {
+    if (_sketch_commands[i].command == command) {
+      entry = _sketch_commands[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// A whole command line has arrived from the management software, its fields
+// already parsed.  Act on it.  A handler that finds its fields bad just
+// returns, leaving the parser's error to be reported here.
+static void process_command(void)
+{
+  if (_parser.error()) {
+    report_error(_parser);
+  } else if (!_known_command) {
     Serial.print("Ec?\n");
-    return;
+  } else {
+    _entry.handler(_parser);
+    if (_parser.error()) {
+      report_error(_parser);
+    }
+  }
+}
+
 
+// Pass whatever serial input has arrived to the parser, acting on each
+// command as its line completes.  A partial line is kept for next time, so
+// nothing here waits on the serial port.
+static void receive_commands(void)
+{
+  while (Serial.available()) {
+    switch (_parser.add(Serial.read())) {
+      case CommandParser::COMMAND:
+        _known_command = find_command(_parser.command(), _entry);
+        _parser.set_signature(_known_command ? _entry.args : NULL);
+        break;
+
+      case CommandParser::LINE:
+#if COWEETA_TIMING
+        {
+          const uint32_t start_us = micros();
+          process_command();
+          _command_time.add_since(start_us);
+        }
+#else
+        process_command();
+#endif
+        break;
+    }
   }
 }
 
@@ -402,6 +1306,7 @@ DataLogger::DataLogger()
 
 static void button_press_irc(void)
 {
+  _button_pressed = true;
 }
 
 
@@ -459,17 +1364,19 @@ void DataLogger::setup()
     die("Data logger card failed, or not present.");
   }
 
-  file_number = get_next_file_number();
-
-  log_file = open_log_file(file_number, FILE_WRITE);
-  log_file.print("# Coweeta log file\n");   //TODO make variable and delay file write.
-  log_file.flush();
+  start_log_file(get_next_file_number());   //TODO delay file write.
+#if COWEETA_TIMING
+  _log_buffer.time_writes(&_write_time);
+#endif
 
   log_to_file_ = true;
   log_to_term_ = false;
 
   _forced_events = 0x0000;
 
+  // Someone has just powered us up, so assume they'll want to talk.
+  _usb_session_end = _logger->get_unix_time() + USB_SESSION_LENGTH;
+
   say_hello();
 
 }
@@ -485,13 +1392,24 @@ void DataLogger::setup()
 // corresponding event's structure.
 void DataLogger::set_schedule(const EventSchedule *schedule_list, uint8_t num_events)
 {
+  if (num_events > COWEETA_MAX_EVENTS) {
+    die("Too many events; raise COWEETA_MAX_EVENTS.");
+  }
+  // Longer intervals could take the scheduler's clock past 32 bits.
+  for (uint8_t i = 0; i < num_events; i++) {
+    if ((schedule_list[i].interval_ms < 1) || (schedule_list[i].interval_ms > MAX_INTERVAL_MS)) {
+      die("Event interval out of range.");
+    }
+  }
   _schedule = schedule_list;
   _num_events = num_events;
   for (uint8_t i = 0; i < num_events; i++) {
     if (schedule_list[i].category == Disabled) {
-      _event_enabled &= ~(1 << i);
+      _event_enabled &= ~event_bit(i);
     }
   }
+  update_now();
+  queue_all_events();
 }
 
 
@@ -506,25 +1424,60 @@ void DataLogger::set_schedule(const EventSchedule *schedule_list, uint8_t num_ev
 // Also extinguishes the active (good) LED while we are waiting, reigniting it
 // when we are done.  I.e. the active light is on only when we are active.
 //
+// While a file is being downloaded the waiting time is spent sending it, a
+// line at a time, instead of sleeping.  If an event falls due part way
+// through, the download picks up where it left off on the next call.
+//
+// If the sketch has taken so long that an event's slots have gone by, it
+// returns at once for those its CatchUp policy says to run late.
+//
 void DataLogger::wait_for_event(void)
 {
+  // The last event's loop() has run.
+#if COWEETA_TIMING
+  time_handling();
+#endif
+  if (_aggregators && (_triggered_events & _report_events)) {
+    write_summaries();
+  }
 
-  _now = _logger->get_unix_time();
+  update_now();
   digitalWrite(good_led_pin_, LOW);
   compute_next_time();
-  while ((_now < _next_time) && !_forced_events) {
+  while ((_now_ms < _next_ms) && !_forced_events) {
+    if (_button_pressed) {
+      _button_pressed = false;
+      note_usb_activity();
+    }
     if (Serial.available()) {
-      process_command();
+      // A download in progress carries on; only 'K' or another download
+      // stops it.
+      note_usb_activity();
+      receive_commands();
       compute_next_time();
+    } else if (!_transfer.finished()) {
+      _transfer.transfer_next();
     } else {
+      check_flush();
       wait_a_while();
     }
-    _now = _logger->get_unix_time();
+    update_now();
+  }
+#if COWEETA_TIMING
+  if (!_forced_events) {
+    time_lateness();
   }
+#endif
   if (_forced_events) {
     _triggered_events = _forced_events;
     _forced_events = 0x0000;
+  } else {
+    move_on_triggered_events();
   }
+#if COWEETA_TIMING
+  _returned_us = micros();
+  _returned = true;
+#endif
   digitalWrite(good_led_pin_, HIGH);
 }
 
@@ -533,69 +1486,215 @@ void DataLogger::wait_for_event(void)
 //
 // Called from the Arduino loop() function after DataLogger::wait_for_event()
 // has returned.
-bool DataLogger::is_event(uint16_t event)
+bool DataLogger::is_event(event_mask_t event)
 {
   return (event & _triggered_events) != 0;
 }
 
 
+void DataLogger::add_commands(const CommandEntry *commands, uint8_t num_commands)
+{
+  _sketch_commands = commands;
+  _num_sketch_commands = num_commands;
+}
+
+
+void DataLogger::set_log_format(LogFormat format)
+{
+  _log_format = format;
+}
+
+
+void DataLogger::set_flush_policy(uint8_t lines, uint16_t seconds, bool before_power_down)
+{
+  _flush_policy.lines = lines;
+  _flush_policy.seconds = seconds;
+  _flush_policy.before_power_down = before_power_down;
+}
+
+
+void DataLogger::flush_log(void)
+{
+  flush_log_file();
+}
+
+
+void DataLogger::set_preallocation(uint32_t bytes)
+{
+  // Whole blocks, so that the raw writes line up with the file's end.
+  _preallocation = (bytes + LogBuffer::SECTOR_SIZE - 1) & ~uint32_t(LogBuffer::SECTOR_SIZE - 1);
+}
+
+
+void DataLogger::set_rotation_policy(uint32_t bytes, uint32_t records, RotationPeriod period)
+{
+  _rotation.bytes = bytes;
+  _rotation.records = records;
+  _rotation.period = period;
+}
+
+
+void DataLogger::set_aggregation(Aggregator *columns, uint8_t num_columns, event_mask_t report_events)
+{
+  _aggregators = columns;
+  _num_aggregators = num_columns;
+  _report_events = report_events;
+}
+
+
+void DataLogger::about_to_power_down(void)
+{
+  if (_flush_policy.before_power_down) {
+    flush_log_file();
+  }
+}
+
+
 void DataLogger::new_log_line(void)
 {
-  char_stream.reset();
-  write_timestamp(char_stream);
+  _sampling = _aggregators != NULL;
+  _column = 0;
+  _line_time = get_unix_time();
+  if (log_to_file_ && rotation_due(_line_time)) {
+    close_log_file();
+    start_log_file(get_next_file_number());
+  }
+  _binary_line = (_log_format == BinaryLog) && log_to_file_ && !_sampling;
+  _csv_line = (_log_format == CsvLog) && log_to_file_ && !_sampling;
+  _text_line = _csv_line || log_to_term_;
+  if (_csv_line || _binary_line) {
+    index_record(_line_time);
+  }
+  if (_binary_line) {
+    // A long record is written out as it goes, so the header goes first.
+    _record.begin(_line_time, &_log_buffer);
+    write_pending_header();
+  }
+  if (log_to_term_) {
+    Serial.print('!');
+  }
+  // The line goes into the file's buffer as it is built, so nothing else
+  // must be written to the file before end_log_line().
+  char_stream.start(_csv_line ? &_log_buffer : NULL, log_to_term_ ? &Serial : NULL);
+  if (_text_line) {
+    write_timestamp(char_stream);
+  }
+}
+
+
+void DataLogger::write_timestamp(Print &stream)
+{
+  _timestamp.update(_line_time);
+  stream.write(_timestamp.text(), Timestamp::LENGTH);
 }
 
 
 void DataLogger::log_string(const char *string)
 {
-  char_stream.print(',');
-  char_stream.print(string);
+  if (_sampling) {
+    _column++;
+  }
+  if (_text_line) {
+    char_stream.append_char(',');
+    char_stream.print(string);
+  }
+  if (_binary_line) {
+    _record.add_string(string);
+  }
 }
 
 
 void DataLogger::log_int(int value)
 {
-  char_stream.print(',');
-  char_stream.print(value);
+  if (_sampling) {
+    add_sample(value);
+  }
+  if (_text_line) {
+    char_stream.append_char(',');
+    char_stream.append_int(value);
+  }
+  if (_binary_line) {
+    _record.add_int(value);
+  }
 }
 
 
 void DataLogger::log_float(double value, uint8_t dec_places)
 {
-  char_stream.print(',');
-  char_stream.print(value, dec_places);
+  if (_sampling) {
+    add_sample(value);
+  }
+  if (_text_line) {
+    char_stream.append_char(',');
+    char_stream.print(value, dec_places);
+  }
+  if (_binary_line) {
+    _record.add_float(value, dec_places);
+  }
 }
 
 
-void DataLogger::skip_entries(uint8_t count)
+void DataLogger::log_fixed(int32_t value, uint8_t scale)
 {
-  for (uint8_t i = 0; i < count; i++) {
-    char_stream.print(',');
+  if (scale > MAX_FIXED_SCALE) {
+    scale = MAX_FIXED_SCALE;
+  }
+  if (_sampling) {
+    int32_t divisor = 1;
+    for (uint8_t i = 0; i < scale; i++) {
+      divisor *= 10;
+    }
+    add_sample(double(value) / divisor);
   }
+  if (_text_line) {
+    char_stream.append_char(',');
+    char_stream.append_fixed(value, scale);
+  }
+  if (_binary_line) {
+    _record.add_fixed(value, scale);
+  }
+}
+
 
+void DataLogger::skip_entries(uint8_t count)
+{
+  if (_sampling) {
+    _column += count;
+  }
+  if (_text_line) {
+    for (uint8_t i = 0; i < count; i++) {
+      char_stream.append_char(',');
+    }
+  }
+  if (_binary_line) {
+    _record.add_skip(count);
+  }
 }
 
 
 void DataLogger::end_log_line(void)
 {
-  // check if we have a log file
-  // check if we have an sd card
-
-  if (char_stream.bytes_written()) {
+  if (_binary_line) {
+    _record.write_to(_log_buffer);
+    _log_buffer.end_line(_line_time);
+    note_record(_line_time);
+    count_line(_record.continued(), _record.overflowed());
+    _binary_line = false;
+  }
 
-    if (log_to_file_) {
-      char_stream.dump(log_file);
-      log_file.print("\n");
-      log_file.flush();
-    }
-    if (log_to_term_) {
-      Serial.print("!");
-      char_stream.dump(Serial);
-      Serial.print("\n");
+  if (_text_line) {
+    char_stream.append_char('\n');
+    if (_csv_line) {
+      _log_buffer.end_line(_line_time);
+      note_record(_line_time);
+      count_line(false, false);
     }
-
+    char_stream.start(NULL, NULL);
+    _text_line = false;
+    _csv_line = false;
   }
 
+  check_flush();
 }
 
 
@@ -606,15 +1705,58 @@ void DataLogger::get_time(int *hour, int *minute, int *second)
 }
 
 
-void DataLogger::enable_events(uint16_t events)
+uint32_t DataLogger::current_time(void)
+{
+  return _now;
+}
+
+
+uint32_t DataLogger::log_line_time(void)
+{
+  return _line_time;
+}
+
+
+uint32_t DataLogger::next_event_time(void)
+{
+  return _next_time;
+}
+
+
+uint16_t DataLogger::next_event_millisecond(void)
+{
+  return (_next_ms == NO_EVENT) ? 0 : _next_ms % 1000;
+}
+
+
+uint32_t DataLogger::get_unix_time_ms(uint16_t &millisecond)
+{
+  millisecond = 0;
+  return get_unix_time();
+}
+
+
+bool DataLogger::usb_session_active(void)
+{
+  return _now < _usb_session_end;
+}
+
+
+void DataLogger::note_usb_activity(void)
+{
+  _usb_session_end = _now + USB_SESSION_LENGTH;
+}
+
+
+void DataLogger::enable_events(event_mask_t events)
 {
-  _event_enabled |= events;
+  set_enabled_events(_event_enabled | events);
 }
 
 
-void DataLogger::disable_events(uint16_t events)
+void DataLogger::disable_events(event_mask_t events)
 {
-  _event_enabled &= ~events;
+  set_enabled_events(_event_enabled & ~events);
 }
 
 
@@ -3,6 +3,12 @@
 
 #include "Arduino.h"
 
+#include "aggregator.h"
+#include "event_set.h"
+#include "fixed_point.h"
+
+class CommandParser;
+
 namespace coweeta {
 
 // This is used exclusively by the EventSchedule structure.
@@ -12,24 +18,97 @@ typedef enum {
 } EventCategory;
 
 
+// What wait_for_event() does about the slots of an event that went by before
+// it could be run: while the sketch's loop() ran on, the card stalled or a
+// command took its time.  Missed slots are counted (see the 'w' command) and
+// noted in the log file, so a gap in the data can be told from a sensor that
+// had nothing to say.  A slot is only missed once it is a second late (or a
+// whole interval, for an event more frequent than that); before then it is
+// just run late.
+typedef enum {
+  SkipMissed,     // carry on from the next slot to come
+  RunOnceLate,    // run once, late, in place of the slots missed
+  RunEachMissed   // run once for each slot missed, late, one after another
+} CatchUp;
+
+
 // This structure is used to define at what frequency events are indended to
 // occur.  A constant array of these structures is passed to the DataLogger
 // object's set_schedule() method.  Rather than hand populate these structures
 // the program would be best to employ helper functions such as event().
 //
-// Note that the maximum interval allowed is a little over 9 hours, so if you
-// require something to happen at, say, a daily interval then you'd set an event
-// with an 8 hour interval and check the time inside the handler code.  Or, if
-// you have a higher frequency event, then just piggyback the low frequency
-// event handling code on it.
+// The event falls due every interval_ms milliseconds, offset_ms after each
+// multiple of the interval counted from midnight, 1970-01-01 UTC: so an event
+// every day (86400000) falls at each midnight UTC, or with an offset of
+// 3600000 at one in the morning.  Intervals can be from a millisecond to
+// MAX_INTERVAL_MS (24 days); DataLogger::set_schedule() stops with an error
+// for any other.  Events under a second apart need a board whose clock counts
+// milliseconds (see DataLogger::get_unix_time_ms()); elsewhere they can only
+// be run once a second.
+//
+// catch_up says what to do about slots that go by before the event can be run
+// (see CatchUp).
+const int32_t MAX_INTERVAL_MS = 24L * 24 * 60 * 60 * 1000;
+
 typedef struct {
   EventCategory category;
   const char *name;
-  int16_t interval;
-  int16_t offset;
+  int32_t interval_ms;
+  int32_t offset_ms;
+  CatchUp catch_up;
 } EventSchedule;
 
 
+// The format of the log files written to the SD card.  See
+// DataLogger::set_log_format().
+typedef enum {
+  CsvLog,
+  BinaryLog
+} LogFormat;
+
+
+// When buffered log lines are made safe on the card.  See
+// DataLogger::set_flush_policy().
+typedef struct {
+  uint8_t lines;            // once this many lines are waiting (0: no limit)
+  uint16_t seconds;         // once the oldest has waited this long (0: no limit)
+  bool before_power_down;   // whenever the board is about to power down
+} FlushPolicy;
+
+
+// Calendar boundaries at which to start a new log file.  See
+// DataLogger::set_rotation_policy().
+typedef enum {
+  NoPeriod,
+  Daily,     // at each midnight (UTC)
+  Weekly     // at the midnight (UTC) going into each Monday
+} RotationPeriod;
+
+
+// When to move on to a new log file.  See DataLogger::set_rotation_policy().
+typedef struct {
+  uint32_t bytes;           // once the file holds this many bytes (0: no limit)
+  uint32_t records;         // once it holds this many records (0: no limit)
+  RotationPeriod period;
+} RotationPolicy;
+
+
+// A command from the management software: the first character of the line,
+// the fields it takes, and the function to handle it.  The fields are given
+// as a signature (see command_parser.h), e.g. "w?uu" for a word optionally
+// followed by two unsigned integers, or "" for none.  They are read as the
+// line arrives, and checked against the signature before the handler is
+// called.  The handler takes them from the parser (checking their ranges) and
+// sends its reply on Serial, ending with a newline.  If the parser reports an
+// error the handler should return without replying; the error is sent back
+// for it.  See DataLogger::add_commands().
+typedef struct {
+  char command;
+  char args[6];
+  void (*handler)(CommandParser &parser);
+} CommandEntry;
+
+
 // Used by DataLogger::set_date_and_time() to update the real-time clock (RTC)
 // from the management software.
 typedef struct {
@@ -52,10 +131,93 @@ public:
   // function.
   void setup(void);
 
+  // Log files are CSV text unless this is called, before setup(), to choose
+  // the compact binary records described in log_record.h (LOGnnnnn.BIN files,
+  // which the management software turns back into CSV).  Log lines echoed to
+  // the management software are text either way.
+  void set_log_format(LogFormat format);
+
+  // Log lines are held in RAM and written to the card a sector (512 bytes) at
+  // a time, which saves the card rewriting the same sector for every line.
+  // They are safe from a power failure only once flushed: after the given
+  // number of lines, once the oldest line has waited the given number of
+  // seconds and, if before_power_down is set, when the board powers down
+  // between events.  A zero turns that limit off.  The default is 60 seconds
+  // and before powering down; set_flush_policy(1, 0) writes each line
+  // through to the card, as older versions did.  Each log file notes the
+  // policy it was written under.  Call before setup().
+  void set_flush_policy(uint8_t lines, uint16_t seconds, bool before_power_down=true);
+
+  // Make every log line so far safe on the card.
+  void flush_log(void);
+
+  // Create each new log file with the given number of bytes allocated to it
+  // in one contiguous run (if the card has one), so that log lines can be
+  // written straight to the card's blocks without touching the FAT or
+  // directory.  The file is trimmed to the length used when the logger moves
+  // to another file; until then it reads as its full size, with zeros after
+  // the last line.  Zero (the default) grows files as they are written.  Call
+  // before setup().
+  void set_preallocation(uint32_t bytes);
+
+  // Move on to a new log file once the current one holds the given number of
+  // bytes or records, or at the start of each day or week, so that no file
+  // grows too big to fetch or search quickly.  A zero turns that limit off;
+  // by default the file is only changed by the management software (the N
+  // command) or a restart.  Either way each file, once finished with, is
+  // added to LOGINDEX.TXT on the card with the times of its first and last
+  // records and how many there are, so that the files covering a stretch of
+  // time can be found without opening them (see the 'I' command in
+  // doc/protocol.rst).  Call before setup().
+  void set_rotation_policy(uint32_t bytes, uint32_t records, RotationPeriod period=NoPeriod);
+
+  // Log summaries of the values rather than the values themselves.  While
+  // this is set, each value a log line gives (log_int() or log_float()) goes
+  // to the aggregator for its column, the first value to the first, and the
+  // line itself is not written to the log file.  Then, once the loop() for
+  // any of the report events has run, a line of each aggregator's summaries
+  // is written in their place, timed at that event, and the aggregators start
+  // afresh.  Strings, and columns past the last aggregator, are dropped.
+  // Lines echoed to the management software are the values, as logged.
+  //
+  // Only the summaries are held between report events, so a sketch can, say,
+  // read a sensor every second and log its hourly mean, minimum and maximum
+  // in a few bytes of RAM and a line an hour.  The samples since the last
+  // report are lost if the board resets.  The aggregators are used in place,
+  // so they must stay put (a static array is best).
+  void set_aggregation(Aggregator *columns, uint8_t num_columns, event_mask_t report_events);
+
+  template <size_t N>
+  inline void set_aggregation(Aggregator (&columns)[N], event_mask_t report_events)
+  {
+    set_aggregation(columns, N, report_events);
+  }
+
+  // Add commands of the sketch's own to those of the management protocol (see
+  // doc/protocol.rst), say to calibrate a sensor in the field.  The table is
+  // used in place, so it must stay put (a static const array is best).  The
+  // protocol's own command characters can't be taken over.
+  void add_commands(const CommandEntry *commands, uint8_t num_commands);
+
+  template <size_t N>
+  inline void add_commands(const CommandEntry (&commands)[N])
+  {
+    add_commands(commands, N);
+  }
+
   // The second phase of initialization, this method is called from the
   // Arduino app's setup() function too.
   void set_schedule(const EventSchedule *schedule, uint8_t num_events);
 
+  // As above, but the number of events is taken from the array and checked
+  // against COWEETA_MAX_EVENTS at compile time.
+  template <size_t N>
+  inline void set_schedule(const EventSchedule (&schedule)[N])
+  {
+    static_assert(N <= COWEETA_MAX_EVENTS, "Too many events; raise COWEETA_MAX_EVENTS");
+    set_schedule(schedule, N);
+  }
+
   // Where the microcontroller spends most of its time; waiting.
   // Returns when the next scheduled event is due to occur (say reading a
   // sensor) or when the human operator requests we trigger the event for the
@@ -69,7 +231,10 @@ public:
   //
   // Example:
   // if (logger.is_event(READ_TEMP | READ_WIND)) ...
-  bool is_event(uint16_t event);
+  //
+  // The mask has one bit per event (see event_set.h); with more than 16 events
+  // the handles are best built with event_bit().
+  bool is_event(event_mask_t event);
 
   // If we have determined that we are going to be recording something to our
   // CSV based log file then call this to create the new entry, starting with
@@ -92,6 +257,22 @@ public:
   // 32 bit integer (i.e +/- 4e9).
   void log_float(double value, uint8_t dec_places);
 
+  // Log value / 10 ** scale, with scale (at most MAX_FIXED_SCALE) digits
+  // after the decimal point: log_fixed(2315, 2) logs 23.15.  The same text as
+  // log_float() gives, but formatted without floating point arithmetic, which
+  // on an AVR is done in software and is slow.  So a sensor reading is best
+  // calibrated in integer units (hundredths of a degree, say) and logged with
+  // this.
+  void log_fixed(int32_t value, uint8_t scale);
+
+  // As above, with the scale checked at compile time: log_fixed<2>(2315).
+  template <uint8_t SCALE>
+  inline void log_fixed(int32_t value)
+  {
+    static_assert(SCALE <= MAX_FIXED_SCALE, "log_fixed() scale too big");
+    log_fixed(value, SCALE);
+  }
+
   // In some situations we are not going to record a value for a particular
   // parameter, or set of parameters.  For example we may not read those
   // sensors on every event.  When this is the case call skip_entries() to
@@ -101,13 +282,16 @@ public:
 
   // Having recorded everything for this time, we call this method to
   // terminate the line and either write it to the log file, or pass it back
-  // to the management application running on a laptop.
+  // to the management application running on a laptop.  (The text goes
+  // straight into the log file's buffer as it is logged, rather than being
+  // copied there from a line buffer, so every new_log_line() must be ended
+  // with this before the next.)
   void end_log_line(void);
 
   void get_time(int *hour, int *minute, int *second);
 
-  void enable_events(uint16_t events);
-  void disable_events(uint16_t events);
+  void enable_events(event_mask_t events);
+  void disable_events(event_mask_t events);
 
 protected:
   void set_device_pins(uint8_t good_led, uint8_t bad_led, uint8_t sd_card);
@@ -117,6 +301,31 @@ protected:
   void set_button_pin(uint8_t pin);
   void set_usb_baud_rate(uint32_t rate);
 
+  // For the board specific wait_a_while(): the time as of the last check, and
+  // the time the next event is due.  Both in seconds since epoch.
+  uint32_t current_time(void);
+  uint32_t next_event_time(void);
+
+  // The time (seconds since epoch) the log line being built was started.  Its
+  // timestamp, binary record, time index entry and log index times all use
+  // this one reading, so they agree even if the line takes a while.
+  uint32_t log_line_time(void);
+
+  // The milliseconds past next_event_time() that the next event is due.
+  uint16_t next_event_millisecond(void);
+
+  // True while the management software is (or recently was) talking to us, or
+  // the button has recently been pressed.  While this holds wait_a_while()
+  // must wake up for serial input.
+  bool usb_session_active(void);
+
+  // Start (or extend) a USB session, e.g. on being woken by serial input.
+  void note_usb_activity(void);
+
+  // Called by wait_a_while() just before the board powers down, so that
+  // buffered log lines can be flushed if the flush policy says so.
+  void about_to_power_down(void);
+
 public:
   // Each of these methods is implemented in the board specific child class.
 
@@ -126,10 +335,19 @@ public:
   // power.
   virtual void wait_a_while(void) = 0;
 
-  // Returns the number of seconds since epoch.
+  // Returns the number of seconds since epoch.  Called on every pass round
+  // the wait loop and for every log line, so should be cheap: a clock kept in
+  // software rather than a read of the RTC.
   //TODO: deprecate.
   virtual uint32_t get_unix_time(void) = 0;
 
+  // As get_unix_time(), also giving the milliseconds (0 to 999) into that
+  // second, read together so that the two agree.  The scheduler runs on this,
+  // so a board that can count milliseconds between the RTC's seconds can
+  // schedule events less than a second apart.  The default gives whole
+  // seconds.
+  virtual uint32_t get_unix_time_ms(uint16_t &millisecond);
+
   // Sets the number of seconds since epoch.
   //TODO: deprecate.
   virtual void set_unix_time(uint32_t seconds) = 0;
@@ -146,25 +364,50 @@ public:
   // Called each time a line is written to the log file.  Must output a text
   // representation of the date and time to the stream.  An example of the
   // output is "2017-07-24 20:36:35".
-  virtual void write_timestamp(Print &stream) = 0;
+  //
+  // The default formats log_line_time(), keeping the date and time text from
+  // the previous call so that it is only stepped on, not worked out afresh.
+  virtual void write_timestamp(Print &stream);
 
 };
 
 
+// Seconds to milliseconds for event().  Anything too big for an int32_t
+// gives the largest there is rather than wrapping round, so that
+// DataLogger::set_schedule() catches it as too long an interval.
+inline int32_t seconds_to_ms(int32_t seconds)
+{
+  const int32_t limit = 0x7FFFFFFFL / 1000;
+  return (seconds > limit) ? 0x7FFFFFFFL : (seconds < -limit) ? -0x7FFFFFFFL : seconds * 1000;
+}
+
+
 // A convenience function used to construct the EventSchedule array used by
-// Datalogger::set_schedule() as part of set up.
-inline EventSchedule event(const char* name, int16_t interval, int16_t offset=0, EventCategory category=Normal)
+// Datalogger::set_schedule() as part of set up.  The interval and offset are
+// in seconds.
+inline EventSchedule event(const char* name, int32_t interval, int32_t offset=0, EventCategory category=Normal,
+                           CatchUp catch_up=SkipMissed)
+{
+  return {.category=category, .name=name, .interval_ms=seconds_to_ms(interval), .offset_ms=seconds_to_ms(offset),
+          .catch_up=catch_up};
+}
+
+
+// As event(), with the interval and offset in milliseconds, for events less
+// than a second apart: event_ms("sample", 50) is an event at 20 Hz.
+inline EventSchedule event_ms(const char* name, int32_t interval_ms, int32_t offset_ms=0,
+                              EventCategory category=Normal, CatchUp catch_up=SkipMissed)
 {
-  return {.category=category, .name=name, .interval=interval, .offset=offset};
+  return {.category=category, .name=name, .interval_ms=interval_ms, .offset_ms=offset_ms, .catch_up=catch_up};
 }
 
 
 // Hour:Minute:Second - A convenience function used in EventSchedule
 // construction.  Converts a interval given as a number of hours, minutes and
 // seconds into the number of seconds.
-inline int16_t HMS(int8_t hours, int8_t minutes, int8_t seconds)
+inline int32_t HMS(int16_t hours, int8_t minutes, int8_t seconds)
 {
-  return hours * 60 * 60 + minutes * 60 + seconds;
+  return hours * 60L * 60 + minutes * 60 + seconds;
 }
 
 
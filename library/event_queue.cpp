@@ -0,0 +1,136 @@
+#include "event_queue.h"
+
+namespace coweeta {
+
+EventQueue::EventQueue()
+{
+  clear();
+}
+
+
+void EventQueue::clear(void)
+{
+  size_ = 0;
+  for (uint8_t i = 0; i < MAX_EVENTS; i++) {
+    pos_[i] = NOT_QUEUED;
+  }
+}
+
+
+void EventQueue::place(uint8_t slot, uint8_t event)
+{
+  heap_[slot] = event;
+  pos_[event] = slot;
+}
+
+
+// Move the event at slot towards the top until its parent is no later.
+void EventQueue::sift_up(uint8_t slot)
+{
+  const uint8_t event = heap_[slot];
+  const uint32_t due = due_[event];
+  while (slot > 0) {
+    const uint8_t parent = (slot - 1) / 2;
+    if (due_[heap_[parent]] <= due) {
+      break;
+    }
+    place(slot, heap_[parent]);
+    slot = parent;
+  }
+  place(slot, event);
+}
+
+
+// Move the event at slot towards the bottom until neither child is earlier.
+void EventQueue::sift_down(uint8_t slot)
+{
+  const uint8_t event = heap_[slot];
+  const uint32_t due = due_[event];
+  while (true) {
+    uint8_t child = 2 * slot + 1;
+    if (child >= size_) {
+      break;
+    }
+    if ((child + 1 < size_) && (due_[heap_[child + 1]] < due_[heap_[child]])) {
+      child++;
+    }
+    if (due <= due_[heap_[child]]) {
+      break;
+    }
+    place(slot, heap_[child]);
+    slot = child;
+  }
+  place(slot, event);
+}
+
+
+void EventQueue::insert(uint8_t event, uint32_t due)
+{
+  if (pos_[event] == NOT_QUEUED) {
+    due_[event] = due;
+    place(size_++, event);
+    sift_up(pos_[event]);
+    return;
+  }
+  const uint32_t old_due = due_[event];
+  due_[event] = due;
+  if (due < old_due) {
+    sift_up(pos_[event]);
+  } else {
+    sift_down(pos_[event]);
+  }
+}
+
+
+void EventQueue::remove(uint8_t event)
+{
+  const uint8_t slot = pos_[event];
+  if (slot == NOT_QUEUED) {
+    return;
+  }
+  pos_[event] = NOT_QUEUED;
+  size_--;
+  if (slot == size_) {
+    return;
+  }
+  // Fill the hole with the last entry and let it find its level.
+  const uint8_t moved = heap_[size_];
+  place(slot, moved);
+  sift_up(slot);
+  sift_down(pos_[moved]);
+}
+
+
+void EventQueue::reschedule_top(uint32_t due)
+{
+  due_[heap_[0]] = due;
+  sift_down(0);
+}
+
+
+void EventQueue::shift_back(uint32_t amount)
+{
+  for (uint8_t slot = 0; slot < size_; slot++) {
+    uint32_t &due = due_[heap_[slot]];
+    due = (due > amount) ? due - amount : 0;
+  }
+}
+
+
+event_mask_t EventQueue::events_below(uint8_t slot, uint32_t time) const
+{
+  if ((slot >= size_) || (due_[heap_[slot]] != time)) {
+    return 0;
+  }
+  return event_bit(heap_[slot]) |
+         events_below(2 * slot + 1, time) |
+         events_below(2 * slot + 2, time);
+}
+
+
+event_mask_t EventQueue::events_at(uint32_t time) const
+{
+  return events_below(0, time);
+}
+
+} // namespace coweeta
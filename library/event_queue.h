@@ -0,0 +1,82 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "Arduino.h"
+
+#include "event_set.h"
+
+namespace coweeta {
+
+// The upcoming deadlines of the enabled events, kept as a binary min-heap so
+// that the earliest is always at the top.
+//
+// Events are identified by their index in the schedule.  Each event is in the
+// queue at most once; inserting an event that is already queued just moves its
+// deadline.
+class EventQueue
+{
+public:
+  static const uint8_t MAX_EVENTS = COWEETA_MAX_EVENTS;
+
+private:
+  static const uint8_t NOT_QUEUED = 0xFF;
+
+  uint32_t due_[MAX_EVENTS];   // deadline for each event, by event index
+  uint8_t heap_[MAX_EVENTS];   // event indices, heap ordered by deadline
+  uint8_t pos_[MAX_EVENTS];    // where each event sits in heap_
+  uint8_t size_;
+
+  void place(uint8_t slot, uint8_t event);
+  void sift_up(uint8_t slot);
+  void sift_down(uint8_t slot);
+  event_mask_t events_below(uint8_t slot, uint32_t time) const;
+
+public:
+  EventQueue();
+
+  void clear(void);
+
+  // Add the event, or move its deadline if it is already queued.
+  void insert(uint8_t event, uint32_t due);
+
+  // Take the event out of the queue.  Does nothing if it isn't queued.
+  void remove(uint8_t event);
+
+  inline bool empty(void) const
+  {
+    return size_ == 0;
+  }
+
+  // Deadline of the earliest event, or 0xFFFFFFFF if the queue is empty.
+  inline uint32_t top_time(void) const
+  {
+    return size_ ? due_[heap_[0]] : 0xFFFFFFFF;
+  }
+
+  // Deadline of the event, or 0xFFFFFFFF if it isn't queued.
+  inline uint32_t due(uint8_t event) const
+  {
+    return (pos_[event] != NOT_QUEUED) ? due_[event] : 0xFFFFFFFF;
+  }
+
+  // Index of the event with the earliest deadline.  Only valid if not empty.
+  inline uint8_t top_event(void) const
+  {
+    return heap_[0];
+  }
+
+  // Give the earliest event a new (later) deadline.
+  void reschedule_top(uint32_t due);
+
+  // Make every deadline earlier by amount (but no earlier than 0), for when
+  // the clock they are measured by is moved on.  The order is unchanged.
+  void shift_back(uint32_t amount);
+
+  // Bit mask of all the events whose deadline is the given time.  Only visits
+  // the part of the heap that can hold such events.
+  event_mask_t events_at(uint32_t time) const;
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef EVENT_QUEUE_H
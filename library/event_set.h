@@ -0,0 +1,56 @@
+#ifndef EVENT_SET_H
+#define EVENT_SET_H
+
+#include "Arduino.h"
+
+// The most events a sketch can put in its schedule.  This sets the width of the
+// event masks used by the DataLogger (is_event(), enable_events() and so on)
+// and by the e, E and w commands.
+//
+// Up to 16 events the masks are a uint16_t, as they always were.  Larger
+// schedules get a uint32_t (up to 32 events) or a uint64_t (up to 64).  As the
+// library is compiled separately from the sketch, a wider setting has to be
+// given in the build flags (e.g. -DCOWEETA_MAX_EVENTS=48) rather than in the
+// sketch itself.
+#ifndef COWEETA_MAX_EVENTS
+#define COWEETA_MAX_EVENTS 16
+#endif
+
+namespace coweeta {
+
+// EventSet<N>::mask_t is the narrowest unsigned integer that has a bit for
+// each of N events.
+template <uint8_t N, bool fits_16 = (N <= 16), bool fits_32 = (N <= 32)>
+struct EventSet {
+  typedef uint64_t mask_t;
+};
+
+template <uint8_t N, bool fits_32>
+struct EventSet<N, true, fits_32> {
+  typedef uint16_t mask_t;
+};
+
+template <uint8_t N>
+struct EventSet<N, false, true> {
+  typedef uint32_t mask_t;
+};
+
+typedef EventSet<COWEETA_MAX_EVENTS>::mask_t event_mask_t;
+
+static_assert(COWEETA_MAX_EVENTS <= 64, "COWEETA_MAX_EVENTS can be at most 64");
+
+// The mask for the event at the given index in the schedule.
+inline event_mask_t event_bit(uint8_t index)
+{
+  return event_mask_t(1) << index;
+}
+
+// The mask with a bit set for each of the first count events.
+inline event_mask_t event_bits_below(uint8_t count)
+{
+  return (count >= 8 * sizeof(event_mask_t)) ? event_mask_t(~event_mask_t(0)) : event_mask_t(event_bit(count) - 1);
+}
+
+} // namespace coweeta
+
+#endif        //  #ifndef EVENT_SET_H
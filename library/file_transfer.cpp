@@ -1,20 +1,50 @@
 #include "file_transfer.h"
 
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
 namespace coweeta {
 
 const int MAX_LINE_LEN = 200;
 
-FileTransfer::FileTransfer(SdFat &sd_card, const char *filename)
+// Bytes of a block read from the file and sent at a time.
+const uint8_t CHUNK_SIZE = 64;
+
+
+// CRC-16/CCITT, reflected (polynomial 0x8408), as avr-libc's
+// _crc_ccitt_update().  Frames start from 0xFFFF.
+static inline uint16_t crc_update(uint16_t crc, uint8_t data)
 {
-  file_ = sd_card.open(filename, FILE_READ);
-  if (!file_) {
-    finished_ = true;
-    return;
+#ifdef __AVR__
+  return _crc_ccitt_update(crc, data);
+#else
+  data ^= uint8_t(crc);
+  data ^= uint8_t(data << 4);
+  return ((uint16_t(data) << 8) | (crc >> 8)) ^ uint8_t(data >> 4) ^ (uint16_t(data) << 3);
+#endif
+}
+
+
+static uint16_t send_bytes(const uint8_t *buffer, uint8_t size, uint16_t crc)
+{
+  for (uint8_t i = 0; i < size; i++) {
+    crc = crc_update(crc, buffer[i]);
   }
-  finished_ = false;
+  Serial.write(buffer, size);
+  return crc;
+}
+
 
+FileTransfer::FileTransfer() :
+  length_(0),
+  end_(0),
+  finished_(true),
+  blocks_(false)
+{
 }
 
+
 FileTransfer::~FileTransfer()
 {
   if (file_) {
@@ -22,6 +52,95 @@ FileTransfer::~FileTransfer()
   }
 }
 
+
+bool FileTransfer::start(SdFat &sd_card, const char *filename, uint32_t length, bool blocks)
+{
+  if (file_) {
+    file_.close();
+  }
+  length_ = length;
+  blocks_ = blocks;
+  file_ = sd_card.open(filename, FILE_READ);
+  end_ = file_size();
+  // A file that can't be read is sent in blocks as an empty one, so that the
+  // other end gets its end frame.
+  finished_ = !file_ && !blocks;
+  return bool(file_);
+}
+
+
+void FileTransfer::set_range(uint32_t offset, uint32_t count)
+{
+  if (offset > end_) {
+    offset = end_;
+  }
+  if (count < end_ - offset) {
+    end_ = offset + count;
+  }
+  if (file_) {
+    file_.seek(offset);
+  }
+}
+
+
+uint32_t FileTransfer::checksum(SdFat &sd_card, const char *filename, uint32_t offset, uint32_t count,
+                                uint32_t limit, uint16_t &crc)
+{
+  crc = 0xFFFF;
+  File file = sd_card.open(filename, FILE_READ);
+  if (!file) {
+    return 0;
+  }
+  if (limit > file.size()) {
+    limit = file.size();
+  }
+  if (offset > limit) {
+    offset = limit;
+  }
+  if (count > limit - offset) {
+    count = limit - offset;
+  }
+  file.seek(offset);
+  uint8_t chunk[CHUNK_SIZE];
+  uint32_t done = 0;
+  while (done < count) {
+    const uint8_t want = (count - done) < CHUNK_SIZE ? (count - done) : CHUNK_SIZE;
+    if (file.read(chunk, want) != want) {
+      break;
+    }
+    for (uint8_t i = 0; i < want; i++) {
+      crc = crc_update(crc, chunk[i]);
+    }
+    done += want;
+  }
+  file.close();
+  return done;
+}
+
+
+// Send the closing line and let go of the file.
+void FileTransfer::finish(const char *marker)
+{
+  Serial.print(marker);
+  finished_ = true;
+  file_.close();
+}
+
+
+void FileTransfer::abort()
+{
+  if (finished_) {
+    return;
+  }
+  if (blocks_) {
+    send_frame_end(send_frame_header(file_.position(), ABORTED));
+    finish("");
+  } else {
+    finish(" \\XA\n");
+  }
+}
+
+
 void FileTransfer::transfer_line()
 {
   size_t sent = 0;
@@ -29,19 +148,18 @@ void FileTransfer::transfer_line()
   Serial.print(' ');
   while (true)
   {
-    if (!file_.available()) {
+    if (!more()) {
       // file ends with non-NL
-      Serial.print("\\XX\n");
-      finished_ = true;
+      finish("\\XX\n");
       return;
     }
-    const char ch = file_.read();
+    // Unsigned, so that bytes from binary files are escaped correctly.
+    const uint8_t ch = file_.read();
     if (ch == '\n') {
       // end of line; send it.
       Serial.print('\n');
-      if (!file_.available()) {
-        finished_ = true;
-        Serial.print(" \\XN\n");
+      if (!more()) {
+        finish(" \\XN\n");
       }
       return;
     } else if ((ch < ' ') || (ch > '~') || (ch == '\\')) {
@@ -51,7 +169,7 @@ void FileTransfer::transfer_line()
       Serial.print(int(ch % 16), HEX);
       sent += 3;
     } else {
-      Serial.print(ch);
+      Serial.print(char(ch));
       sent++;
     }
     if (sent > MAX_LINE_LEN) {
@@ -62,4 +180,64 @@ void FileTransfer::transfer_line()
   }
 }
 
+
+// The frame header is 'b', then the offset in the file (uint32) and the
+// length of the data (uint16), little endian.  The CRC covers all but the 'b'.
+uint16_t FileTransfer::send_frame_header(uint32_t offset, uint16_t size)
+{
+  uint8_t header[6];
+  for (uint8_t i = 0; i < 4; i++) {
+    header[i] = uint8_t(offset >> (8 * i));
+  }
+  header[4] = uint8_t(size);
+  header[5] = uint8_t(size >> 8);
+  Serial.write('b');
+  return send_bytes(header, sizeof(header), 0xFFFF);
+}
+
+
+void FileTransfer::send_frame_end(uint16_t crc)
+{
+  Serial.write(uint8_t(crc));
+  Serial.write(uint8_t(crc >> 8));
+}
+
+
+// The data is read and sent a chunk at a time, so the frame needs no buffer of
+// its own.  Its length has gone out before the data is read, so if the card
+// fails us the rest of the frame is made up with zeros and sent with a wrong
+// CRC, and the transfer aborted.
+void FileTransfer::transfer_block()
+{
+  const uint32_t offset = file_ ? file_.position() : 0;
+  const uint32_t left = end_ - offset;
+  uint16_t size = BLOCK_SIZE - offset % BLOCK_SIZE;
+  if (left < size) {
+    size = left;
+  }
+  uint16_t crc = send_frame_header(offset, size);
+  bool okay = true;
+  uint8_t chunk[CHUNK_SIZE];
+  for (uint16_t sent = 0; sent < size; ) {
+    const uint8_t want = (size - sent) < CHUNK_SIZE ? (size - sent) : CHUNK_SIZE;
+    if (okay && (file_.read(chunk, want) != want)) {
+      okay = false;
+    }
+    if (!okay) {
+      memset(chunk, 0, want);
+    }
+    crc = send_bytes(chunk, want, crc);
+    sent += want;
+  }
+  if (!okay) {
+    send_frame_end(~crc);
+    abort();
+    return;
+  }
+  send_frame_end(crc);
+  if (size == END_OF_FILE) {
+    finish("");
+  }
+}
+
 } // namespace coweeta
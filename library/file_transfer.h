@@ -5,26 +5,97 @@
 
 namespace coweeta {
 
+// Sends a file from the SD card down the USB link, a piece at a time, so that
+// the sending can be spread out between the logger's other work.  The file
+// stays open, and keeps its place, between calls to transfer_next().
+//
+// There are two ways of sending the file (see doc/protocol.rst):
+//
+// - as text lines, with anything unprintable escaped (the G command), or
+// - in blocks: binary frames of up to a sector, each with its offset in the
+//   file and a CRC (the B command).  This is much quicker, particularly for
+//   binary log files, which would otherwise be mostly escapes.
+//
+// Either way, just part of the file can be sent (see set_range()), so that
+// the management software can fetch only what has been added since it last
+// looked, or pick up where a broken download left off.
 class FileTransfer
 {
+public:
+  static const uint16_t BLOCK_SIZE = 512;
+
+  // Block frame lengths with special meanings.
+  static const uint16_t END_OF_FILE = 0;
+  static const uint16_t ABORTED = 0xFFFF;
+
 private:
   File file_;
+  uint32_t length_;      // bytes of the file that may be sent
+  uint32_t end_;         // where this transfer stops
   bool finished_;
+  bool blocks_;
+
+  inline bool more()
+  {
+    return file_.available() && (file_.position() < end_);
+  }
+
+  void finish(const char *marker);
+  uint16_t send_frame_header(uint32_t offset, uint16_t size);
+  void send_frame_end(uint16_t crc);
 
 public:
-  FileTransfer(SdFat &sd_card, const char *filename);
+  FileTransfer();
   ~FileTransfer();
-  
+
+  // Open the file and get ready to send it, in blocks or as lines.  Only the
+  // first length bytes of the file are sent.  Returns false if the file can't
+  // be opened.
+  bool start(SdFat &sd_card, const char *filename, uint32_t length=0xFFFFFFFF, bool blocks=false);
+
+  // Send only count bytes of the file, from offset, rather than all of it.
+  // Call before the first transfer_next().  A range running past the end of
+  // the file is cut short.
+  void set_range(uint32_t offset, uint32_t count);
+
+  // Work out the CRC (as used for block frames, starting from 0xFFFF) of
+  // count bytes of the file from offset, going no further than limit.  This
+  // lets the management software check that a copy it holds matches before
+  // fetching the rest.  Returns the number of bytes covered; none if the file
+  // can't be opened.
+  static uint32_t checksum(SdFat &sd_card, const char *filename, uint32_t offset, uint32_t count,
+                           uint32_t limit, uint16_t &crc);
+
+  // Give up on the file part way through, telling the other end so.
+  void abort();
+
   inline size_t file_size()
   {
-    return file_.size();
+    return file_.size() < length_ ? file_.size() : length_;
   }
 
   inline bool finished()
   {
     return finished_;
   }
+
+  // Send the next piece of the file: a line or a block, as chosen by
+  // start().  Other output can go between calls.
+  inline void transfer_next()
+  {
+    if (blocks_) {
+      transfer_block();
+    } else {
+      transfer_line();
+    }
+  }
+
+  // Send the next line of the file (or a whole part of an over-long line).
   void transfer_line();
+
+  // Send the next frame of the file.  Frames are a sector long, lined up
+  // with the file's sectors, except at the end.
+  void transfer_block();
 };
 
 } // namespace coweeta
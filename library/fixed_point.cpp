@@ -0,0 +1,54 @@
+#include "fixed_point.h"
+
+namespace coweeta {
+
+static const uint8_t MAX_DIGITS = 10;
+
+static const uint32_t POWERS_OF_TEN[MAX_DIGITS] PROGMEM = {
+  1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+  10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+
+static inline uint32_t power_of_ten(uint8_t index)
+{
+  uint32_t power;
+  memcpy_P(&power, &POWERS_OF_TEN[index], sizeof(power));
+  return power;
+}
+
+
+uint8_t format_fixed(char *text, int32_t value, uint8_t scale)
+{
+  if (scale > MAX_FIXED_SCALE) {
+    scale = MAX_FIXED_SCALE;
+  }
+  char *out = text;
+  uint32_t magnitude = uint32_t(value);
+  if (value < 0) {
+    *out++ = '-';
+    magnitude = 0 - magnitude;
+  }
+  // Leading zeros are left off, but there is always a digit before the point.
+  const uint8_t point = MAX_DIGITS - scale;
+  uint8_t i = 0;
+  while ((i < point - 1) && (magnitude < power_of_ten(i))) {
+    i++;
+  }
+  for (; i < MAX_DIGITS; i++) {
+    const uint32_t power = power_of_ten(i);
+    char digit = '0';
+    while (magnitude >= power) {
+      magnitude -= power;
+      digit++;
+    }
+    if (i == point) {
+      *out++ = '.';
+    }
+    *out++ = digit;
+  }
+  *out = '\0';
+  return out - text;
+}
+
+} // namespace coweeta
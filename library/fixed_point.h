@@ -0,0 +1,24 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include "Arduino.h"
+
+namespace coweeta {
+
+// The most digits after the decimal point a fixed point value can have: a
+// scale of 9 puts every int32_t between -3 and 3.
+static const uint8_t MAX_FIXED_SCALE = 9;
+
+// Room for the longest text, e.g. "-2.147483648", and its NUL.
+static const uint8_t FIXED_TEXT_SIZE = 13;
+
+// Write value / 10 ** scale to text as a decimal with scale digits after the
+// point (none for a scale of 0), as Print::print(double, scale) would, NUL
+// terminated.  Returns the length.  The digits are found by subtracting
+// powers of ten from a table, rather than by dividing: AVRs have no divide
+// instruction, and a 32 bit division takes hundreds of cycles.
+uint8_t format_fixed(char *text, int32_t value, uint8_t scale);
+
+} // namespace coweeta
+
+#endif        //  #ifndef FIXED_POINT_H
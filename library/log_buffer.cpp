@@ -0,0 +1,153 @@
+#include "log_buffer.h"
+
+namespace coweeta {
+
+LogBuffer::LogBuffer() :
+  file_(NULL),
+  card_(NULL),
+  block_(0),
+  last_block_(0),
+  length_(0),
+  used_(0),
+  space_(SECTOR_SIZE),
+  lines_(0),
+  oldest_(0),
+  write_times_(NULL)
+{
+}
+
+
+void LogBuffer::attach(File &file)
+{
+  file_ = &file;
+  card_ = NULL;
+  used_ = 0;
+  lines_ = 0;
+  length_ = file.size();
+  space_ = SECTOR_SIZE - length_ % SECTOR_SIZE;
+}
+
+
+void LogBuffer::attach_contiguous(File &file, SdSpiCard *card, uint32_t first_block, uint32_t last_block)
+{
+  file_ = &file;
+  card_ = card;
+  block_ = first_block;
+  last_block_ = last_block;
+  used_ = 0;
+  lines_ = 0;
+  length_ = 0;
+  space_ = SECTOR_SIZE;
+}
+
+
+// Hand the buffered bytes to the file.  Unless this is a whole sector, the
+// next write out will be the rest of the sector.
+//
+// Raw blocks only go out whole.  Once the contiguous file is full we carry
+// on appending to it through the file system.  Each write out is timed, if
+// asked (see time_writes()).
+void LogBuffer::write_out(void)
+{
+  const uint32_t start_us = write_times_ ? micros() : 0;
+  if (card_) {
+    card_->writeBlock(block_, buffer_);
+    used_ = 0;
+    if (block_++ == last_block_) {
+      card_ = NULL;
+      file_->seek(length_);
+    }
+  } else {
+    if (file_ && used_) {
+      file_->write(buffer_, used_);
+    }
+    space_ -= used_;
+    if (space_ == 0) {
+      space_ = SECTOR_SIZE;
+    }
+    used_ = 0;
+  }
+  if (write_times_) {
+    write_times_->add_since(start_us);
+  }
+}
+
+
+size_t LogBuffer::write(const uint8_t *buffer, size_t size)
+{
+  size_t left = size;
+  while (left) {
+    size_t chunk = space_ - used_;
+    if (chunk > left) {
+      chunk = left;
+    }
+    memcpy(&buffer_[used_], buffer, chunk);
+    used_ += chunk;
+    length_ += chunk;
+    buffer += chunk;
+    left -= chunk;
+    if (used_ == space_) {
+      write_out();
+    }
+  }
+  return size;
+}
+
+
+size_t LogBuffer::write(uint8_t ch)
+{
+  buffer_[used_++] = ch;
+  length_++;
+  if (used_ == space_) {
+    write_out();
+  }
+  return 1;
+}
+
+
+void LogBuffer::end_line(uint32_t time)
+{
+  if (lines_ == 0) {
+    oldest_ = time;
+  }
+  if (lines_ != 0xFF) {
+    lines_++;
+  }
+}
+
+
+void LogBuffer::flush(void)
+{
+  if (!used_ && !lines_) {
+    return;
+  }
+  lines_ = 0;
+  if (card_) {
+    if (used_) {
+      // Timed as write_out() times a full block.
+      const uint32_t start_us = write_times_ ? micros() : 0;
+      memset(&buffer_[used_], 0, SECTOR_SIZE - used_);
+      card_->writeBlock(block_, buffer_);
+      if (write_times_) {
+        write_times_->add_since(start_us);
+      }
+    }
+    return;
+  }
+  write_out();
+  if (file_) {
+    file_->flush();
+  }
+}
+
+
+void LogBuffer::finish(void)
+{
+  flush();
+  if (card_ && file_) {
+    file_->truncate(length_);
+    card_ = NULL;
+  }
+}
+
+} // namespace coweeta
@@ -0,0 +1,100 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <SdFat.h>
+
+#include "timing_histogram.h"
+
+namespace coweeta {
+
+// Write-behind buffer between the log lines and the log file.
+//
+// Lines are collected in RAM and handed to the file a whole 512 byte sector
+// at a time, lined up with the file's sectors, so the card never has to read
+// a sector back in to add a line to it.  Nothing is made safe on the card
+// (the file's directory entry updated) until flush() is called; the DataLogger
+// does that according to its flush policy (see DataLogger::set_flush_policy()).
+//
+// A file that has been allocated contiguously (see attach_contiguous()) is
+// written block by block straight to the card, bypassing the file system.
+// Its FAT entries and size were set when it was allocated, so no metadata is
+// written until finish() trims it to the length actually used.
+class LogBuffer : public Print
+{
+public:
+  static const uint16_t SECTOR_SIZE = 512;
+
+private:
+  File *file_;
+  SdSpiCard *card_;      // set while writing raw blocks
+  uint32_t block_;       // raw block that buffer_ belongs in
+  uint32_t last_block_;  // last block of the contiguous file
+  uint32_t length_;      // bytes of the file used, buffer_ included
+  uint8_t buffer_[SECTOR_SIZE];
+  uint16_t used_;
+  uint16_t space_;       // bytes left before the end of the file's sector
+  uint8_t lines_;        // lines held since the last flush()
+  uint32_t oldest_;      // time of the first of those lines
+  TimingHistogram *write_times_;
+
+  void write_out(void);
+
+public:
+  LogBuffer();
+
+  // Buffer the writes to the file, which is open for appending.  Anything
+  // held for the previous file must already have been finished.
+  void attach(File &file);
+
+  // As attach(), but for a newly created file occupying the given range of
+  // blocks on the card, into which it is to be written from the start.  If
+  // the file fills up, further writes are appended to it as usual.
+  void attach_contiguous(File &file, SdSpiCard *card, uint32_t first_block, uint32_t last_block);
+
+  // Add the time each write to the card takes to the histogram (NULL to
+  // stop).
+  inline void time_writes(TimingHistogram *histogram)
+  {
+    write_times_ = histogram;
+  }
+
+  size_t write(uint8_t ch);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  // Note that a line (timed at the given seconds since epoch) is complete.
+  void end_line(uint32_t time);
+
+  // Write out whatever is held and sync the file.  Does nothing if there is
+  // nothing to write.  For a contiguous file this writes the block holding the
+  // latest line (padded with zeros), which is written again as it fills.
+  void flush(void);
+
+  // Flush, and trim a contiguous file to the length used, before the file is
+  // closed.
+  void finish(void);
+
+  // Bytes written to the file so far, including those still held here.  For
+  // a contiguous file this is less than its size until finish().
+  inline uint32_t length(void) const
+  {
+    return length_;
+  }
+
+  // Number of whole lines written since the last flush(): at risk on a power
+  // failure even if they have gone on to the card.
+  inline uint8_t lines_unflushed(void) const
+  {
+    return lines_;
+  }
+
+  // Time of the first line not yet flushed.  Only valid if lines_unflushed().
+  inline uint32_t oldest_unflushed(void) const
+  {
+    return oldest_;
+  }
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef LOG_BUFFER_H
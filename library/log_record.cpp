@@ -0,0 +1,220 @@
+#include "log_record.h"
+
+namespace coweeta {
+
+static const char MAGIC[] = "COWB";
+static const uint8_t VERSION = 3;
+
+
+static uint32_t zigzag(int32_t value)
+{
+  return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+
+static void write_uint16(Print &dest, uint16_t value)
+{
+  dest.write(uint8_t(value));
+  dest.write(uint8_t(value >> 8));
+}
+
+
+static void write_uint32(Print &dest, uint32_t value)
+{
+  write_uint16(dest, uint16_t(value));
+  write_uint16(dest, uint16_t(value >> 16));
+}
+
+
+LogRecord::LogRecord() :
+  size_(0),
+  time_(0),
+  last_time_(0),
+  spill_(NULL),
+  continued_(false),
+  overflow_(false)
+{
+}
+
+
+void LogRecord::begin(uint32_t time, Print *spill)
+{
+  size_ = 0;
+  time_ = time;
+  spill_ = spill;
+  continued_ = false;
+  overflow_ = false;
+}
+
+
+// Make room for a field of the given size, spilling the record so far if
+// need be.  A record never holds a partial field: one that won't fit even in
+// a record of its own is dropped.  When spilling, the last byte is kept for
+// the continued tag.
+bool LogRecord::reserve(uint8_t bytes)
+{
+  const uint8_t room = spill_ ? MAX_SIZE - 1 : MAX_SIZE;
+  if (size_ + bytes <= room) {
+    return true;
+  }
+  if (spill_ && size_ && (bytes <= room)) {
+    fields_[size_++] = CONTINUED_TAG;
+    write_to(*spill_);
+    size_ = 0;
+    continued_ = true;
+    return true;
+  }
+  overflow_ = true;
+  return false;
+}
+
+
+void LogRecord::put_varint(uint32_t value)
+{
+  while (value >= 0x80) {
+    fields_[size_++] = uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+  fields_[size_++] = uint8_t(value);
+}
+
+
+void LogRecord::add_int(int32_t value)
+{
+  if (reserve(6)) {
+    fields_[size_++] = INT_TAG;
+    put_varint(zigzag(value));
+  }
+}
+
+
+void LogRecord::add_string(const char *string)
+{
+  const size_t length = strlen(string);
+  if ((length + 2 <= MAX_SIZE) && reserve(length + 2)) {
+    fields_[size_++] = STRING_TAG;
+    memcpy(&fields_[size_], string, length + 1);
+    size_ += length + 1;
+  } else {
+    overflow_ = true;
+  }
+}
+
+
+void LogRecord::add_skip(uint8_t count)
+{
+  if (reserve(2)) {
+    fields_[size_++] = SKIP_TAG;
+    fields_[size_++] = count;
+  }
+}
+
+
+// The value is stored as an integer number of 10 ** -dec_places units, which
+// is generally shorter than the float.  The digits are worked out just as
+// Print::print() does, so that the decoded text is the same as the CSV file's.
+// Values too big for that (or NaN) are stored as is.
+void LogRecord::add_float(double value, uint8_t dec_places)
+{
+  if (!reserve(6)) {
+    return;
+  }
+  if (dec_places > 15) {
+    dec_places = 15;
+  }
+  const bool negative = value < 0.0;
+  double number = negative ? -value : value;
+  double rounding = 0.5;
+  uint32_t limit = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < dec_places; i++) {
+    rounding /= 10.0;
+    limit /= 10;
+  }
+  number += rounding;
+
+  if (number < limit) {
+    uint32_t scaled = uint32_t(number);
+    double remainder = number - scaled;
+    for (uint8_t i = 0; i < dec_places; i++) {
+      remainder *= 10.0;
+      const uint8_t digit = uint8_t(remainder);
+      remainder -= digit;
+      scaled = scaled * 10 + digit;
+    }
+    fields_[size_++] = (negative ? NEGATIVE_FIXED_TAG : FIXED_TAG) + dec_places;
+    put_varint(scaled);
+    return;
+  }
+  const float single = value;
+  fields_[size_++] = FLOAT_TAG + dec_places;
+  memcpy(&fields_[size_], &single, sizeof(single));
+  size_ += sizeof(single);
+}
+
+
+// Already scaled, so stored just as a float would be.
+void LogRecord::add_fixed(int32_t value, uint8_t scale)
+{
+  if (!reserve(6)) {
+    return;
+  }
+  const bool negative = value < 0;
+  fields_[size_++] = (negative ? NEGATIVE_FIXED_TAG : FIXED_TAG) + scale;
+  put_varint(negative ? 0 - uint32_t(value) : uint32_t(value));
+}
+
+
+void LogRecord::write_header(Print &dest, bool appending, const FlushPolicy &policy,
+                             const EventSchedule *schedule, uint8_t num_events)
+{
+  if (appending) {
+    dest.write(uint8_t(0));
+  }
+  dest.write(MAGIC);
+  dest.write(VERSION);
+  write_uint32(dest, time_);
+  dest.write(policy.lines);
+  write_uint16(dest, policy.seconds);
+  dest.write(uint8_t(policy.before_power_down));
+  dest.write(num_events);
+  for (uint8_t i = 0; i < num_events; i++) {
+    write_uint32(dest, schedule[i].interval_ms);
+    write_uint32(dest, schedule[i].offset_ms);
+    dest.write(schedule[i].name);
+    dest.write(uint8_t(0));
+  }
+  last_time_ = time_;
+}
+
+
+void LogRecord::write_to(Print &dest)
+{
+  uint8_t step[5];
+  uint8_t step_size = 0;
+  uint32_t value = zigzag(int32_t(time_ - last_time_));
+  while (value >= 0x80) {
+    step[step_size++] = uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+  step[step_size++] = uint8_t(value);
+
+  dest.write(uint8_t(step_size + size_));
+  dest.write(step, step_size);
+  dest.write(fields_, size_);
+  last_time_ = time_;
+}
+
+void LogRecord::write_gap(Print &dest, uint8_t event, uint32_t count, uint32_t first)
+{
+  size_ = 0;
+  fields_[size_++] = GAP_TAG;
+  fields_[size_++] = event;
+  put_varint(count);
+  for (uint8_t i = 0; i < 4; i++) {
+    fields_[size_++] = uint8_t(first >> (8 * i));
+  }
+  time_ = last_time_;
+  write_to(dest);
+}
+
+} // namespace coweeta
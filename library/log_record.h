@@ -0,0 +1,135 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include "Arduino.h"
+
+#include "data_logger.h"
+
+namespace coweeta {
+
+// Builds the lines of a binary log file (see DataLogger::set_log_format()).
+//
+// A binary log file starts with a header:
+//
+//   "COWB"            magic
+//   3                 format version (one byte)
+//   base time         seconds since epoch, uint32 little endian
+//   flush policy      lines (one byte), seconds (uint16 little endian) and
+//                     before power down (one byte); see FlushPolicy
+//   event count       one byte
+//   for each event:   interval and offset in milliseconds (int32 little
+//                     endian), then the name, NUL terminated
+//
+// after which come the records, one per log line:
+//
+//   length            one byte, the number of bytes that follow
+//   time step         seconds since the previous record (or the base time),
+//                     zigzag varint
+//   fields            each a tag byte followed by its value
+//
+// The field tags are:
+//
+//   0x01              log_int(): zigzag varint
+//   0x02              log_string(): the text, NUL terminated
+//   0x03              skip_entries(): the count (one byte)
+//   0x04              (no value; always the last field) the log line goes on
+//                     in the next record, whose time step is 0
+//   0x05              (the only field of a record whose time step is 0) a
+//                     gap: the event's index (one byte), the number of its
+//                     slots missed (varint) and the time of the first (uint32
+//                     little endian); see CatchUp in data_logger.h
+//   0x10 + places     log_float() or log_fixed(), value >= 0: varint of the
+//                     value scaled by 10 ** places and rounded (places is at
+//                     most 15)
+//   0x20 + places     log_float() or log_fixed(), value < 0: as above, for
+//                     the magnitude
+//   0x30 + places     log_float(), too big to scale: IEEE single, little endian
+//
+// Where logging carries on in an existing file a zero length byte is written,
+// followed by a fresh header.  A zero length byte followed by anything else,
+// or a length of 0xFF, is the unused end of a pre-allocated file.
+//
+// Varints are little endian base 128 (7 bits per byte, top bit set on all but
+// the last byte).  Zigzag maps 0, -1, 1, -2... to 0, 1, 2, 3...
+//
+// man_tool/binary_log.py turns these files back into CSV text.
+class LogRecord
+{
+public:
+  static const uint8_t MAX_SIZE = 128;
+
+  enum {
+    INT_TAG = 0x01,
+    STRING_TAG = 0x02,
+    SKIP_TAG = 0x03,
+    CONTINUED_TAG = 0x04,
+    GAP_TAG = 0x05,
+    FIXED_TAG = 0x10,
+    NEGATIVE_FIXED_TAG = 0x20,
+    FLOAT_TAG = 0x30
+  };
+
+private:
+  uint8_t fields_[MAX_SIZE];
+  uint8_t size_;
+  uint32_t time_;        // time of the record being built
+  uint32_t last_time_;   // time of the previous record written
+  Print *spill_;
+  bool continued_;
+  bool overflow_;
+
+  bool reserve(uint8_t bytes);
+  void put_varint(uint32_t value);
+
+public:
+  LogRecord();
+
+  // Start building a record for the given time (seconds since epoch).  A
+  // log line too long for one record is written to spill as it goes, a
+  // record at a time, each marked as continued in the next; without spill,
+  // fields that don't fit are dropped.  Only a string too long for a record
+  // of its own is dropped either way.
+  void begin(uint32_t time, Print *spill=NULL);
+
+  void add_int(int32_t value);
+  void add_string(const char *string);
+  void add_skip(uint8_t count);
+  void add_float(double value, uint8_t dec_places);
+  void add_fixed(int32_t value, uint8_t scale);
+
+  // Write a file header, taking the time of the record being built as the
+  // base time.  If appending, the header is preceded by a zero length byte.
+  void write_header(Print &dest, bool appending, const FlushPolicy &policy,
+                    const EventSchedule *schedule, uint8_t num_events);
+
+  // Write the record built since begin().
+  void write_to(Print &dest);
+
+  // Write a record noting that count slots of the event, the first at the
+  // given time, were missed.  Its time step is zero, so the records either
+  // side are timed as if it weren't there.  Not for use while building a
+  // record.
+  void write_gap(Print &dest, uint8_t event, uint32_t count, uint32_t first);
+
+  // The time the next record's time step will count from.
+  inline uint32_t last_time(void) const
+  {
+    return last_time_;
+  }
+
+  // True if a field has been dropped since begin() for want of space.
+  inline bool overflowed(void) const
+  {
+    return overflow_;
+  }
+
+  // True if part of the line has been spilled since begin().
+  inline bool continued(void) const
+  {
+    return continued_;
+  }
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef LOG_RECORD_H
@@ -27,12 +27,14 @@ enum {
   RED_LED_PIN = 9,
   SD_CARD_SS_PIN = 12,
   BUTTON_PIN = 24,
+  USB_RX_PIN = 0,
   RTC_PIN = A7,
   BATTERY_SENSE_PIN = A6
 };
 
 
-MayflyDataLogger::MayflyDataLogger()
+MayflyDataLogger::MayflyDataLogger() :
+  tickless_(false)
 {
   set_device_pins(GREEN_LED_PIN, RED_LED_PIN, SD_CARD_SS_PIN);
   set_button_pin(BUTTON_PIN);
@@ -44,10 +46,49 @@ MayflyDataLogger::MayflyDataLogger()
 }
 
 
-/// Triggered every second by the DS3231 real-time clock module.
+/// The time the RTC alarm is set for; 0 when it is ticking every second.
+static volatile uint32_t alarm_time_ = 0;
+
+/// The time (seconds since epoch) kept in software, so that reading it doesn't
+/// need the I2C bus.  Advanced by the RTC's interrupt and checked against the
+/// RTC itself whenever it might have gone astray.
+static volatile uint32_t soft_time_ = 0;
+static volatile bool soft_time_valid_ = false;
+
+/// The RTC won't interrupt again until its flag is cleared, so ticks that come
+/// more than a second after an uncleared one are lost.  Track when that was.
+static volatile bool tick_uncleared_ = false;
+static volatile uint32_t tick_millis_ = 0;
+
+/// Set by the RTC interrupt; used to tell why we woke from power down.
+static volatile bool rtc_fired_ = false;
+
+
+/// Triggered every second by the DS3231 real-time clock module, or by its
+/// alarm in tickless mode.
 static void rtc_isr(void)
 {
-  //Leave this blank
+  // The pin change interrupt also fires when the flag is cleared.
+  if (digitalRead(RTC_PIN) != LOW) {
+    return;
+  }
+  if (alarm_time_) {
+    soft_time_ = alarm_time_;
+  } else {
+    soft_time_++;
+  }
+  tick_uncleared_ = true;
+  tick_millis_ = millis();
+  rtc_fired_ = true;
+}
+
+
+static volatile bool usb_rx_seen_ = false;
+
+/// Only attached while powered down: activity on the USB serial line.
+static void usb_rx_isr(void)
+{
+  usb_rx_seen_ = true;
 }
 
 
@@ -70,21 +111,97 @@ void MayflyDataLogger::setup(void)
     //TODO work out dying die("RTC failed");
   }
 
+  sync_clock();
+
 
   DataLogger::setup();
 
 }
 
 
+/// Set the software clock from the RTC.
+void MayflyDataLogger::sync_clock(void)
+{
+  const uint32_t now = rtc.now().getEpoch();
+  noInterrupts();
+  soft_time_ = now;
+  soft_time_valid_ = true;
+  tick_millis_ = millis();
+  interrupts();
+}
+
+
+/// Usually just reads the software clock.  Goes back to the RTC if ticks may
+/// have been lost: after a long stretch awake (e.g. a slow event handler), or
+/// after being woken from power down by something other than the alarm.
 uint32_t MayflyDataLogger::get_unix_time(void)
 {
-  return rtc.now().getEpoch();
+  noInterrupts();
+  const bool stale = !soft_time_valid_ || (tick_uncleared_ && (millis() - tick_millis_ > 950));
+  interrupts();
+  if (stale) {
+    sync_clock();
+  }
+  noInterrupts();
+  const uint32_t now = soft_time_;
+  interrupts();
+  return now;
+}
+
+
+/// The milliseconds are counted by millis() (Timer0, which keeps running in
+/// idle sleep) from the last RTC tick, so the RTC still keeps the time and
+/// the timer only has to be right for a second at a time.
+uint32_t MayflyDataLogger::get_unix_time_ms(uint16_t &millisecond)
+{
+  get_unix_time();
+  noInterrupts();
+  const uint32_t now = soft_time_;
+  const uint32_t since_tick = millis() - tick_millis_;
+  interrupts();
+  millisecond = since_tick > 999 ? 999 : since_tick;
+  return now;
 }
 
 
 void MayflyDataLogger::set_unix_time(uint32_t seconds)
 {
   rtc.setEpoch(seconds);
+  noInterrupts();
+  soft_time_ = seconds;
+  soft_time_valid_ = true;
+  interrupts();
+}
+
+
+void MayflyDataLogger::set_tickless(bool tickless)
+{
+  tickless_ = tickless;
+}
+
+
+/// The furthest ahead the RTC alarm can be set.
+static const uint32_t ALARM_REACH = 86400UL - 1;
+
+
+/// Point the RTC alarm at the given time (seconds since epoch), or set it
+/// ticking every second if time is 0.  Only talks to the RTC on a change.
+///
+/// The DS3231's alarm 1 is set to match on hours, minutes and seconds, so the
+/// time must be less than a day (ALARM_REACH) ahead, or the alarm would go off
+/// early and rtc_isr() would put the clock forward to the time.
+void MayflyDataLogger::set_alarm(uint32_t time)
+{
+  if (time == alarm_time_) {
+    return;
+  }
+  if (time) {
+    const uint32_t second_of_day = time % 86400UL;
+    rtc.enableInterrupts(second_of_day / 3600, (second_of_day / 60) % 60, second_of_day % 60);
+  } else {
+    rtc.enableInterrupts(EverySecond);
+  }
+  alarm_time_ = time;
 }
 
 
@@ -92,12 +209,46 @@ void MayflyDataLogger::wait_a_while(void)
 {
   Serial.flush();
 
-  // The next timed interrupt will not be sent until this is cleared
-  rtc.clearINTStatus();
+  // Power down until the next event, unless someone is talking to us or the
+  // event is so close that the alarm might be set too late to catch it.  An
+  // event more than a day off is waited for a day at a time.
+  const uint32_t next_time = next_event_time();
+  const uint32_t now = current_time();
+  const bool power_down = tickless_ && !usb_session_active() &&
+                          (next_time > now + 1) && (next_time != 0xFFFFFFFF);
+  const uint32_t alarm = (next_time - now > ALARM_REACH) ? now + ALARM_REACH : next_time;
+  set_alarm(power_down ? alarm : 0);
+
+  // The next timed interrupt will not be sent until this is cleared.  Events
+  // due part way through a second have us waking on every millis() interrupt,
+  // so only go over I2C when there's a tick to clear.
+  noInterrupts();
+  const bool clear = tick_uncleared_ || power_down;
+  interrupts();
+  if (clear) {
+    rtc.clearINTStatus();
+  }
+  noInterrupts();
+  if (clear) {
+    tick_uncleared_ = false;
+  }
+  rtc_fired_ = false;
+  interrupts();
 
   // Disable ADC
   ADCSRA &= ~_BV(ADEN);
 
+  // The USART can't wake us from power down, but a level change on its RX pin
+  // can.  The character that does it is lost - hence the leading space
+  // recommended by the protocol.
+  if (power_down) {
+    about_to_power_down();
+    PcInt::attachInterrupt(USB_RX_PIN, usb_rx_isr);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  } else {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+  }
+
   // Sleep time
   noInterrupts();
   sleep_enable();
@@ -105,36 +256,23 @@ void MayflyDataLogger::wait_a_while(void)
   sleep_cpu();
   sleep_disable();
 
+  if (power_down) {
+    PcInt::detachInterrupt(USB_RX_PIN);
+    if (!rtc_fired_) {
+      soft_time_valid_ = false;
+    }
+    if (usb_rx_seen_) {
+      usb_rx_seen_ = false;
+      note_usb_activity();
+    }
+  }
+
   // Re-enable ADC
   ADCSRA |= _BV(ADEN);
 
 }
 
 
-static void print_two_digit(Print &stream, uint8_t value)
-{
-    stream.print(char((value / 10) + '0'));
-    stream.print(char((value % 10) + '0'));
-}
-
-void MayflyDataLogger::write_timestamp(Print &stream)
-{
-  const DateTime timestamp = rtc.now();
-  stream.print(timestamp.year());
-  stream.print('-');
-  print_two_digit(stream, timestamp.month());
-  stream.print('-');
-  print_two_digit(stream, timestamp.date());
-  stream.print(' ');
-  print_two_digit(stream, timestamp.hour());
-  stream.print(':');
-  print_two_digit(stream, timestamp.minute());
-  stream.print(':');
-  print_two_digit(stream, timestamp.second());
-}
-
-
-
 float MayflyDataLogger::rtc_temperature(void)
 {
   return rtc.getTemperature();
@@ -21,13 +21,22 @@ class MayflyDataLogger : public DataLogger
     /// Return the temperature of the real-time clock module, in Celcius.
     float rtc_temperature(void);
 
+    /// In tickless mode the RTC's alarm is set for the next event and the
+    /// micro is powered down until then, rather than being woken every second.
+    /// While a USB session is active it ticks every second as before.  Off by
+    /// default.
+    void set_tickless(bool tickless);
+
   private:
+    bool tickless_;
+
     void wait_a_while(void);
+    void set_alarm(uint32_t time);
+    void sync_clock(void);
 
     uint32_t get_unix_time(void);
+    uint32_t get_unix_time_ms(uint16_t &millisecond);
     void set_unix_time(uint32_t);
-
-    void write_timestamp(Print &stream);
 };
 
 } // namespace coweeta
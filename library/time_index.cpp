@@ -0,0 +1,149 @@
+#include "time_index.h"
+
+namespace coweeta {
+
+TimeIndex::TimeIndex() :
+  sd_card_(NULL),
+  records_(0),
+  header_offset_(0),
+  pending_(0)
+{
+  filename_[0] = '\0';
+}
+
+
+const char *TimeIndex::index_filename(const char *log_filename)
+{
+  static char filename[13];
+  strncpy(filename, log_filename, sizeof(filename) - 1);
+  filename[sizeof(filename) - 1] = '\0';
+  char *dot = strchr(filename, '.');
+  if (dot && (dot - filename <= 8)) {
+    strcpy(dot, ".TIX");
+  }
+  return filename;
+}
+
+
+void TimeIndex::start(SdFat &sd_card, const char *log_filename)
+{
+  sd_card_ = &sd_card;
+  strcpy(filename_, index_filename(log_filename));
+  records_ = 0;
+  header_offset_ = 0;
+  pending_ = 0;
+}
+
+
+void TimeIndex::add_record(uint32_t offset, uint32_t previous_time)
+{
+  if (records_++ != 0) {
+    if (records_ == INTERVAL) {
+      records_ = 0;
+    }
+    return;
+  }
+  uint8_t *entry = entries_[pending_++];
+  for (uint8_t i = 0; i < 4; i++) {
+    entry[i] = offset >> (8 * i);
+    entry[4 + i] = previous_time >> (8 * i);
+    entry[8 + i] = header_offset_ >> (8 * i);
+  }
+  if (pending_ == PENDING) {
+    flush();
+  }
+}
+
+
+void TimeIndex::note_header(uint32_t offset)
+{
+  header_offset_ = offset;
+}
+
+
+void TimeIndex::flush(void)
+{
+  if (!pending_ || !sd_card_) {
+    return;
+  }
+  File index = sd_card_->open(filename_, FILE_WRITE);
+  if (index) {
+    index.write(&entries_[0][0], pending_ * ENTRY_SIZE);
+    index.close();
+  }
+  pending_ = 0;
+}
+
+
+// The entry at the given position in the index file.
+static bool read_entry(File &index, uint32_t position, uint32_t &offset, uint32_t &time,
+                       uint32_t *header_offset=NULL)
+{
+  uint8_t entry[TimeIndex::ENTRY_SIZE];
+  if (!index.seek(position * TimeIndex::ENTRY_SIZE) || (index.read(entry, sizeof(entry)) != sizeof(entry))) {
+    return false;
+  }
+  offset = 0;
+  time = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    offset |= uint32_t(entry[i]) << (8 * i);
+    time |= uint32_t(entry[4 + i]) << (8 * i);
+  }
+  if (header_offset) {
+    *header_offset = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      *header_offset |= uint32_t(entry[8 + i]) << (8 * i);
+    }
+  }
+  return true;
+}
+
+
+// The first entry (0 to entries) timed after the given time.  The entry
+// times only go up, so a binary search will do.
+static uint32_t first_entry_after(File &index, uint32_t entries, uint32_t time)
+{
+  uint32_t low = 0;
+  uint32_t high = entries;
+  while (low < high) {
+    const uint32_t middle = low + (high - low) / 2;
+    uint32_t offset, entry_time;
+    if (!read_entry(index, middle, offset, entry_time)) {
+      return entries;
+    }
+    if (entry_time > time) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+
+void TimeIndex::find(SdFat &sd_card, const char *log_filename, uint32_t from, uint32_t to,
+                     uint32_t &offset, uint32_t &count, uint32_t &base_time, uint32_t &header_offset)
+{
+  offset = 0;
+  count = 0xFFFFFFFF;
+  base_time = 0;
+  header_offset = 0;
+  File index = sd_card.open(index_filename(log_filename));
+  if (!index) {
+    return;
+  }
+  const uint32_t entries = index.size() / ENTRY_SIZE;
+  // Start at the last entry timed before the stretch.
+  const uint32_t first = from ? first_entry_after(index, entries, from - 1) : 0;
+  if (first > 0) {
+    read_entry(index, first - 1, offset, base_time, &header_offset);
+  }
+  const uint32_t last = first_entry_after(index, entries, to);
+  uint32_t end, end_time;
+  if ((last < entries) && read_entry(index, last, end, end_time)) {
+    count = end - offset;
+  }
+  index.close();
+}
+
+} // namespace coweeta
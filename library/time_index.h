@@ -0,0 +1,71 @@
+#ifndef TIME_INDEX_H
+#define TIME_INDEX_H
+
+#include <SdFat.h>
+
+namespace coweeta {
+
+// Sparse index of the record times in a log file, kept beside it on the card
+// (LOGnnnnn.TIX for LOGnnnnn.CSV or .BIN), so that the records from a stretch
+// of time can be found without reading the log from the start.
+//
+// Every INTERVAL-th record, starting with the first, gets an entry: the
+// record's offset in the log file, the time of the record before it (for the
+// first, its own time) and, for a binary log, the offset of the header the
+// record comes under (the last written before it), each uint32 little endian.
+// A header written where logging carries on in the file may come straight
+// after the entry's offset, ahead of the record itself.  Every record before
+// an entry is no later than the entry's time, so a search can start at the
+// last entry timed before the stretch and stop at the first timed after it.
+// For a binary log the entry's time is also the one the record's time step
+// counts from.
+//
+// Entries are held in RAM until flush(), which the DataLogger calls when it
+// flushes the log, so they cost no more card writes than the log itself.
+class TimeIndex
+{
+public:
+  static const uint8_t INTERVAL = 64;
+  static const uint8_t ENTRY_SIZE = 12;
+
+private:
+  static const uint8_t PENDING = 8;
+
+  SdFat *sd_card_;
+  char filename_[13];
+  uint8_t records_;      // since the last entry
+  uint32_t header_offset_;
+  uint8_t pending_;
+  uint8_t entries_[PENDING][ENTRY_SIZE];
+
+public:
+  TimeIndex();
+
+  // Index a new log file, of the given name.  Anything pending for the last
+  // one must already have been flushed.
+  void start(SdFat &sd_card, const char *log_filename);
+
+  // A record is about to be written to the log file at the given offset; the
+  // record before it was made at the given time.
+  void add_record(uint32_t offset, uint32_t previous_time);
+
+  // A binary log's header (its "COWB") has been written at the given offset.
+  void note_header(uint32_t offset);
+
+  // Append the pending entries to the index file.
+  void flush(void);
+
+  // The name of the index file for the named log file.  Uses a static buffer.
+  static const char *index_filename(const char *log_filename);
+
+  // Find the part of the named log file that holds the records from the
+  // given stretch of time (both ends included): its offset and length, the
+  // time to count the first record's time step from and the offset of the
+  // header to decode it with.  Without an index the whole file is given.
+  static void find(SdFat &sd_card, const char *log_filename, uint32_t from, uint32_t to,
+                   uint32_t &offset, uint32_t &count, uint32_t &base_time, uint32_t &header_offset);
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef TIME_INDEX_H
@@ -0,0 +1,113 @@
+#include "timestamp.h"
+
+namespace coweeta {
+
+static const uint32_t SECONDS_PER_DAY = 86400UL;
+
+// Where each field sits in "YYYY-MM-DD HH:MM:SS".
+enum {
+  YEAR_POS = 0,
+  MONTH_POS = 5,
+  DAY_POS = 8,
+  HOUR_POS = 11,
+  MINUTE_POS = 14,
+  SECOND_POS = 17
+};
+
+
+static void put_two_digits(char *dest, uint8_t value)
+{
+  dest[0] = '0' + value / 10;
+  dest[1] = '0' + value % 10;
+}
+
+
+// Adds one to the two digit field, returning true (and leaving it at "00") if
+// it reaches limit.
+static bool increment_field(char *field, uint8_t limit)
+{
+  if (field[1] != '9') {
+    field[1]++;
+  } else {
+    field[1] = '0';
+    field[0]++;
+  }
+  if ((field[0] - '0') * 10 + (field[1] - '0') == limit) {
+    field[0] = field[1] = '0';
+    return true;
+  }
+  return false;
+}
+
+
+Timestamp::Timestamp() :
+  time_(0),
+  day_start_(0)
+{
+  memcpy(text_, "1970-01-01 00:00:00", LENGTH + 1);
+}
+
+
+// Convert days since 1970-01-01 to year, month and day.  This is Howard
+// Hinnant's civil_from_days(), restricted to dates after 1970.
+void Timestamp::set_date(uint32_t day)
+{
+  const uint32_t z = day + 719468UL;
+  const uint32_t era = z / 146097UL;
+  const uint32_t doe = z - era * 146097UL;
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint16_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint8_t mp = (5 * doy + 2) / 153;
+  const uint8_t d = doy - (153 * mp + 2) / 5 + 1;
+  const uint8_t m = mp < 10 ? mp + 3 : mp - 9;
+  const uint16_t y = yoe + era * 400 + (m <= 2);
+
+  put_two_digits(&text_[YEAR_POS], y / 100);
+  put_two_digits(&text_[YEAR_POS + 2], y % 100);
+  put_two_digits(&text_[MONTH_POS], m);
+  put_two_digits(&text_[DAY_POS], d);
+}
+
+
+void Timestamp::set_time_of_day(uint32_t second_of_day)
+{
+  const uint16_t minute_of_day = second_of_day / 60;
+  put_two_digits(&text_[HOUR_POS], minute_of_day / 60);
+  put_two_digits(&text_[MINUTE_POS], minute_of_day % 60);
+  put_two_digits(&text_[SECOND_POS], second_of_day % 60);
+}
+
+
+// Moves the time of day on by a few seconds without going past midnight.
+void Timestamp::step_seconds(uint32_t seconds)
+{
+  while (seconds--) {
+    if (increment_field(&text_[SECOND_POS], 60)) {
+      if (increment_field(&text_[MINUTE_POS], 60)) {
+        increment_field(&text_[HOUR_POS], 24);
+      }
+    }
+  }
+}
+
+
+void Timestamp::update(uint32_t time)
+{
+  if (time == time_) {
+    return;
+  }
+  const uint32_t second_of_day = time - day_start_;
+  if ((time < day_start_) || (second_of_day >= SECONDS_PER_DAY)) {
+    const uint32_t day = time / SECONDS_PER_DAY;
+    day_start_ = day * SECONDS_PER_DAY;
+    set_date(day);
+    set_time_of_day(time - day_start_);
+  } else if ((time > time_) && (time - time_ < 60)) {
+    step_seconds(time - time_);
+  } else {
+    set_time_of_day(second_of_day);
+  }
+  time_ = time;
+}
+
+} // namespace coweeta
@@ -0,0 +1,42 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include "Arduino.h"
+
+namespace coweeta {
+
+// The text form of a time, as used at the start of each log line:
+// "2017-07-24 20:36:35".
+//
+// The text is kept between calls.  The date part is only worked out again when
+// the day changes, and the time of day is stepped on from the previous value,
+// so formatting a timestamp usually costs a few increments.
+class Timestamp
+{
+public:
+  static const uint8_t LENGTH = 19;
+
+private:
+  char text_[LENGTH + 1];
+  uint32_t time_;        // the time (seconds since epoch) that text_ holds
+  uint32_t day_start_;   // midnight (seconds since epoch) of the day of time_
+
+  void set_date(uint32_t day);
+  void set_time_of_day(uint32_t second_of_day);
+  void step_seconds(uint32_t seconds);
+
+public:
+  Timestamp();
+
+  // Bring the text up to date for the given time (seconds since epoch).
+  void update(uint32_t time);
+
+  inline const char *text(void) const
+  {
+    return text_;
+  }
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef TIMESTAMP_H
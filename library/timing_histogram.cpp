@@ -0,0 +1,52 @@
+#include "timing_histogram.h"
+
+namespace coweeta {
+
+TimingHistogram::TimingHistogram()
+{
+  clear();
+}
+
+
+void TimingHistogram::clear(void)
+{
+  memset(counts_, 0, sizeof(counts_));
+  longest_ = 0;
+}
+
+
+uint8_t TimingHistogram::bucket_of(uint32_t us)
+{
+  uint8_t bucket = 0;
+  us >>= 8;
+  while (us && (bucket < BUCKETS - 1)) {
+    us >>= 2;
+    bucket++;
+  }
+  return bucket;
+}
+
+
+void TimingHistogram::add(uint32_t us)
+{
+  uint16_t &count = counts_[bucket_of(us)];
+  if (count != 0xFFFF) {
+    count++;
+  }
+  if (us > longest_) {
+    longest_ = us;
+  }
+}
+
+
+void TimingHistogram::print(Print &out) const
+{
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    out.print(' ');
+    out.print(counts_[i]);
+  }
+  out.print(' ');
+  out.print(longest_);
+}
+
+} // namespace coweeta
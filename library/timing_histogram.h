@@ -0,0 +1,64 @@
+#ifndef TIMING_HISTOGRAM_H
+#define TIMING_HISTOGRAM_H
+
+#include "Arduino.h"
+
+// Set to 1 in the build flags (-DCOWEETA_TIMING=1) to have the DataLogger
+// keep histograms of how late each event is handled, how long the sketch
+// takes over it, and how long card writes and serial commands take, for the
+// 'H' command.  They cost 40 bytes of RAM per event (COWEETA_MAX_EVENTS of
+// them) and a few micros() calls per event, so are left out by default.  As
+// with COWEETA_MAX_EVENTS the library has to be built with the same setting
+// as the sketch.
+#ifndef COWEETA_TIMING
+#define COWEETA_TIMING 0
+#endif
+
+namespace coweeta {
+
+// Counts of durations, in microseconds, in buckets each four times as wide as
+// the one before: under 256us, under 1.024ms, under 4.096ms and so on up to
+// under 1.048576s, with everything longer in the last.  The counts stop at
+// 65535 rather than wrap.  The longest duration seen is kept as well.
+class TimingHistogram
+{
+public:
+  static const uint8_t BUCKETS = 8;
+
+private:
+  uint16_t counts_[BUCKETS];
+  uint32_t longest_;
+
+public:
+  TimingHistogram();
+
+  void add(uint32_t us);
+
+  // Add the time since start_us (a micros() reading).
+  inline void add_since(uint32_t start_us)
+  {
+    add(micros() - start_us);
+  }
+
+  void clear(void);
+
+  inline uint16_t count(uint8_t bucket) const
+  {
+    return counts_[bucket];
+  }
+
+  inline uint32_t longest(void) const
+  {
+    return longest_;
+  }
+
+  // The bucket a duration falls in.
+  static uint8_t bucket_of(uint32_t us);
+
+  // The counts and then the longest, each after a space.
+  void print(Print &out) const;
+};
+
+} // namespace coweeta
+
+#endif        //  #ifndef TIMING_HISTOGRAM_H
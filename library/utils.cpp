@@ -32,13 +32,53 @@ namespace coweeta {
 }
 
 
-const char*  build_filename(uint16_t file_num) {
-   static char filename[] = "LOG_000.CSV";
-   filename[4] = file_num / 100 + '0';
-   filename[5] = (file_num / 10) % 10 + '0';
-   filename[6] = file_num % 10 + '0';
+// LOGnnnnn.CSV for text log files, LOGnnnnn.BIN for binary ones.
+const char*  build_filename(uint32_t file_num, bool binary) {
+   static char filename[] = "LOG00000.CSV";
+   for (uint8_t i = 7; i >= 3; i--) {
+     filename[i] = file_num % 10 + '0';
+     file_num /= 10;
+   }
+   memcpy(&filename[9], binary ? "BIN" : "CSV", 3);
    return filename;
 }
 
 
+// The number of the log file with the given name, or -1 if it isn't one.
+int32_t parse_filename(const char *filename) {
+  if (strncasecmp(filename, "LOG", 3) != 0) {
+    return -1;
+  }
+  int32_t file_num = 0;
+  for (uint8_t i = 3; i < 8; i++) {
+    if ((filename[i] < '0') || (filename[i] > '9')) {
+      return -1;
+    }
+    file_num = file_num * 10 + (filename[i] - '0');
+  }
+  if ((strcasecmp(&filename[8], ".CSV") != 0) && (strcasecmp(&filename[8], ".BIN") != 0)) {
+    return -1;
+  }
+  return file_num;
+}
+
+
+// Print has no 64 bit support, so wide event masks are converted here.
+void print_event_mask(Print &stream, event_mask_t mask)
+{
+#if COWEETA_MAX_EVENTS > 32
+  char buf[21];
+  char *digit = &buf[sizeof(buf) - 1];
+  *digit = '\0';
+  do {
+    *--digit = '0' + mask % 10;
+    mask /= 10;
+  } while (mask);
+  stream.print(digit);
+#else
+  stream.print(uint32_t(mask));
+#endif
+}
+
+
 }
@@ -1,8 +1,15 @@
 #include <SdFat.h>
 
+#include "event_set.h"
+
 namespace coweeta {
 
 void print_root_directory(const SdFat &sd_card);
-const char*  build_filename(uint16_t file_num);
+// Log files are numbered from 0 to this.
+static const uint32_t MAX_FILE_NUMBER = 99999;
+
+const char*  build_filename(uint32_t file_num, bool binary=false);
+int32_t parse_filename(const char *filename);
+void print_event_mask(Print &stream, event_mask_t mask);
 
 } // namespace coweeta
@@ -0,0 +1,245 @@
+#!/usr/bin/env python
+"""Expand a binary log file (LOGnnnnn.BIN) back into CSV text.
+
+The format is described in library/log_record.h.  The output matches what the
+logger would have written to LOGnnnnn.CSV, with the event schedule from the
+file's header added as a comment line.
+
+Usage: binary_log.py LOG00000.BIN [LOG00000.CSV]
+"""
+
+import collections
+import datetime
+import struct
+import sys
+
+MAGIC = b"COWB"
+VERSION = 3
+
+INT_TAG = 0x01
+STRING_TAG = 0x02
+SKIP_TAG = 0x03
+CONTINUED_TAG = 0x04
+GAP_TAG = 0x05
+FIXED_TAG = 0x10
+NEGATIVE_FIXED_TAG = 0x20
+FLOAT_TAG = 0x30
+
+
+class BinaryLogError(Exception):
+    pass
+
+
+# Slots of an event that the logger missed (see CatchUp in
+# library/data_logger.h): the event's name, how many and the time (seconds
+# since epoch) of the first.
+Gap = collections.namedtuple('Gap', 'event count first')
+
+
+def _read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def _unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def _format_fixed(magnitude, places, negative):
+    text = str(magnitude)
+    if places:
+        text = text.rjust(places + 1, '0')
+        text = text[:-places] + '.' + text[-places:]
+    return '-' + text if negative else text
+
+
+def _format_float(value, places):
+    """As the Arduino Print class formats a float."""
+    if value != value:
+        return 'nan'
+    if value in (float('inf'), float('-inf')):
+        return 'inf'
+    if abs(value) > 4294967040.0:
+        return 'ovf'
+    return '{:.{}f}'.format(value, places)
+
+
+def read_header(data):
+    """The (base time, flush policy, events) of the header at the start of
+    data, or None if data stops part way through it."""
+    try:
+        return _read_header(data, 0)[:3]
+    except (IndexError, ValueError, struct.error):
+        if data[:4] != MAGIC[:len(data)]:
+            raise BinaryLogError("not a Coweeta binary log file")
+        return None
+
+
+def _read_header(data, pos):
+    if data[pos:pos + 4] != MAGIC:
+        raise BinaryLogError("not a Coweeta binary log file")
+    version = data[pos + 4]
+    if version not in (2, VERSION):
+        raise BinaryLogError("unsupported binary log version {}".format(version))
+    base_time, flush_lines, flush_seconds, flush_power_down, num_events = \
+        struct.unpack_from('<IBHBB', data, pos + 5)
+    policy = (flush_lines, flush_seconds, flush_power_down)
+    pos += 14
+    events = []
+    for i in range(num_events):
+        if version == 2:
+            # in seconds
+            interval, offset = struct.unpack_from('<hh', data, pos)
+            interval, offset, pos = interval * 1000, offset * 1000, pos + 4
+        else:
+            interval, offset = struct.unpack_from('<ii', data, pos)
+            pos += 8
+        end = data.index(b'\0', pos)
+        events.append((data[pos:end].decode('ascii'), interval, offset))
+        pos = end + 1
+    return base_time, policy, events, pos
+
+
+def _decode_fields(data, pos, end, events):
+    """The record's fields, and whether the line goes on in the next record.
+    A gap record's only field is a Gap."""
+    fields = []
+    while pos < end:
+        tag = data[pos]
+        pos += 1
+        if tag == GAP_TAG:
+            event = data[pos]
+            count, pos = _read_varint(data, pos + 1)
+            (first,) = struct.unpack_from('<I', data, pos)
+            fields.append(Gap(events[event][0], count, first))
+            pos += 4
+        elif tag == INT_TAG:
+            value, pos = _read_varint(data, pos)
+            fields.append(str(_unzigzag(value)))
+        elif tag == STRING_TAG:
+            nul = data.index(b'\0', pos)
+            fields.append(data[pos:nul].decode('latin-1'))
+            pos = nul + 1
+        elif tag == SKIP_TAG:
+            fields.extend([''] * data[pos])
+            pos += 1
+        elif tag == CONTINUED_TAG:
+            return fields, True
+        elif tag & 0xF0 in (FIXED_TAG, NEGATIVE_FIXED_TAG):
+            value, pos = _read_varint(data, pos)
+            fields.append(_format_fixed(value, tag & 0x0F, tag & 0xF0 == NEGATIVE_FIXED_TAG))
+        elif tag & 0xF0 == FLOAT_TAG:
+            (value,) = struct.unpack_from('<f', data, pos)
+            fields.append(_format_float(value, tag & 0x0F))
+            pos += 4
+        else:
+            raise BinaryLogError("bad field tag {:#x}".format(tag))
+    return fields, False
+
+
+def decode(data, gaps=False):
+    """Generate the (time, header, fields) of each record in the file's bytes.
+
+    time is seconds since epoch; header is (policy, events), where policy is
+    the flush policy as a (lines, seconds, before_power_down) tuple and events
+    the file's schedule as (name, interval, offset) tuples, in milliseconds;
+    fields are the logged values as text.  A record cut short (say by a power failure) ends
+    the file, as does the padding (zeros or 0xFF) at the end of a pre-allocated
+    file that wasn't closed.  Gap records are left out unless gaps is set,
+    when each is given with a Gap in place of the fields.
+    """
+    base_time, policy, events, pos = _read_header(data, 0)
+    return _decode_records(data, pos, base_time, policy, events, gaps)
+
+
+def decode_part(data, base_time, header_data):
+    """As decode(), for part of a file (as sent for the logger's 'Q' command)
+    starting at a record, whose time step counts from base_time.  The header
+    is taken from header_data, which starts with the one the part comes under,
+    unless the part starts with a header of its own."""
+    if data[:4] == MAGIC:
+        return decode(data)
+    if data[:1] == b'\0' and data[1:5] == MAGIC:
+        return _decode_records(data, 0, base_time, None, [])
+    _, policy, events = read_header(header_data)
+    return _decode_records(data, 0, base_time, policy, events)
+
+
+def _decode_records(data, pos, time, policy, events, gaps=False):
+    line = []
+    while pos < len(data):
+        length = data[pos]
+        pos += 1
+        if length == 0xFF:
+            return
+        if length == 0:
+            if data[pos:pos + 4] != MAGIC:
+                return
+            # logging carried on in an existing file
+            time, policy, events, pos = _read_header(data, pos)
+            continue
+        end = pos + length
+        if end > len(data):
+            return
+        step, pos = _read_varint(data, pos)
+        time += _unzigzag(step)
+        fields, continued = _decode_fields(data, pos, end, events)
+        pos = end
+        if fields and isinstance(fields[0], Gap):
+            if gaps:
+                yield time, (policy, events), fields[0]
+            continue
+        line.extend(fields)
+        if not continued:
+            yield time, (policy, events), line
+            line = []
+
+
+def _seconds(ms):
+    return str(ms // 1000) if ms % 1000 == 0 else str(ms / 1000)
+
+
+def _timestamp(time):
+    return datetime.datetime.fromtimestamp(time, datetime.timezone.utc).strftime("%Y-%m-%d %H:%M:%S")
+
+
+def to_csv(data, out):
+    """Write the CSV text for the binary log file's bytes to the file out."""
+    out.write("# Coweeta log file\n")
+    last_header = None
+    for time, header, fields in decode(data, gaps=True):
+        if header != last_header:
+            policy, events = header
+            out.write("# flush lines={} seconds={} power_down={}\n".format(*policy))
+            out.write("# events: {}\n".format(" ".join(
+                "{}({},{})".format(name, _seconds(interval), _seconds(offset))
+                for name, interval, offset in events)))
+            last_header = header
+        if isinstance(fields, Gap):
+            out.write("# missed {} {} from {}\n".format(fields.event, fields.count, _timestamp(fields.first)))
+        else:
+            out.write(",".join([_timestamp(time)] + fields) + "\n")
+
+
+def convert_file(bin_filename, csv_filename):
+    with open(bin_filename, 'rb') as f:
+        data = f.read()
+    with open(csv_filename, 'w', newline='\n') as out:
+        to_csv(data, out)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3:
+        convert_file(sys.argv[1], sys.argv[2])
+    elif len(sys.argv) == 2:
+        with open(sys.argv[1], 'rb') as f:
+            to_csv(f.read(), sys.stdout)
+    else:
+        sys.exit(__doc__)
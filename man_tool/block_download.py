@@ -0,0 +1,151 @@
+#!/usr/bin/env python
+"""Receive a file sent by the logger's 'B' (download file in blocks) command.
+
+The frames are described in doc/protocol.rst.  Lines of text from the logger
+('!' log lines and the like) can come between frames; they are handed back to
+the caller rather than written to the file.
+
+Run on its own, this pulls the file out of a saved copy of the logger's
+output (say from test/schedule_sim -v).  Each download found (whole, ranged
+or, from a 'Q' command, a stretch of time) is written into FILE at its
+offset:
+
+Usage: block_download.py SERIAL_OUTPUT FILE
+"""
+
+import struct
+import sys
+
+BLOCK_SIZE = 512
+END_OF_FILE = 0
+ABORTED = 0xFFFF
+
+
+class BlockDownloadError(Exception):
+    pass
+
+
+class DownloadAborted(BlockDownloadError):
+    pass
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT as avr-libc's _crc_ccitt_update()."""
+    for byte in data:
+        byte ^= crc & 0xFF
+        byte ^= (byte << 4) & 0xFF
+        crc = (((byte << 8) | (crc >> 8)) ^ (byte >> 4) ^ (byte << 3)) & 0xFFFF
+    return crc
+
+
+class BlockReceiver:
+    """Write the frames arriving on stream to the file out.
+
+    stream needs read() and readline(), as a serial.Serial or a file opened in
+    binary mode.  Text lines found between frames are passed to on_line()
+    (without the newline).  offset is where in the file the download was asked
+    to start; out should be positioned there.
+    """
+
+    def __init__(self, stream, out, on_line=None, offset=0, stall_reads=50):
+        self._s = stream
+        self._out = out
+        self._on_line = on_line
+        self._stall_reads = stall_reads
+        self.offset = offset
+        self.done = False
+
+    def _read(self, count):
+        data = b''
+        stalls = 0
+        while len(data) < count:
+            got = self._s.read(count - len(data))
+            if not got:
+                stalls += 1
+                if stalls >= self._stall_reads:
+                    raise BlockDownloadError("logger stopped sending at offset {}".format(self.offset))
+            data += got
+        return data
+
+    def receive(self, max_frames=16):
+        """Take up to max_frames frames.  Returns the bytes of the file got."""
+        got = 0
+        for _ in range(max_frames):
+            if self.done:
+                break
+            first = self._read(1)
+            if first != b'b':
+                line = first + self._s.readline()
+                if self._on_line:
+                    self._on_line(line.rstrip(b'\n'))
+                continue
+            header = self._read(6)
+            offset, length = struct.unpack('<IH', header)
+            if length == ABORTED:
+                self._read(2)
+                raise DownloadAborted("download stopped at offset {}".format(offset))
+            data = self._read(length)
+            (crc,) = struct.unpack('<H', self._read(2))
+            if crc != crc16(header + data):
+                raise BlockDownloadError("bad CRC in frame at offset {}".format(offset))
+            if offset != self.offset:
+                raise BlockDownloadError("frame at offset {}, expected {}".format(offset, self.offset))
+            if length == END_OF_FILE:
+                self.done = True
+                break
+            self._out.write(data)
+            self.offset += length
+            got += length
+        return got
+
+
+def crc_of_file(filename, offset, count):
+    """The CRC the logger's 'C' command gives for the same range."""
+    with open(filename, 'rb') as f:
+        f.seek(offset)
+        data = f.read(count)
+    return crc16(data), len(data)
+
+
+def extract(serial_filename, filename):
+    """Pull the files sent after each 'B' or 'Q' reply out of saved output.
+
+    Which ranges were asked for isn't in the output, so the start of each
+    download is taken from its first frame.
+    """
+    found = 0
+    with open(serial_filename, 'rb') as stream, open(filename, 'wb') as out:
+        for line in iter(stream.readline, b''):
+            if line.startswith(b'B'):
+                size = int(line[1:])
+            elif line.startswith(b'Q'):
+                offset, count = (int(field) for field in line[1:].split()[:2])
+                size = offset + count
+            else:
+                continue
+            start = stream.tell()
+            first = stream.read(1)
+            while first not in (b'b', b''):
+                stream.readline()
+                start = stream.tell()
+                first = stream.read(1)
+            if not first:
+                raise BlockDownloadError("no frame after the reply")
+            (offset,) = struct.unpack('<I', stream.read(4))
+            stream.seek(start)
+            out.seek(offset)
+            receiver = BlockReceiver(stream, out, offset=offset, stall_reads=1)
+            while not receiver.done:
+                receiver.receive()
+            if receiver.offset > size:
+                raise BlockDownloadError("got to {} of {}".format(receiver.offset, size))
+            found += 1
+    if not found:
+        raise BlockDownloadError("no 'B' or 'Q' reply found")
+    return found
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    extract(sys.argv[1], sys.argv[2])
@@ -16,6 +16,8 @@ class IncomingComms:
             '#': [],
             '!': [],
             ' ': []}
+        # Lines for read_replies() that take_line() was given.
+        self._unread = []
 
     def flush(self):
         others = {}
@@ -33,6 +35,20 @@ class IncomingComms:
         return others
 
 
+    def take_line(self, line):
+        """File a line that arrived outside read_stuff() (say during a download).
+
+        Log lines and the like go to the buffers; anything else (replies and
+        '@' markers) is kept for read_replies(), so that the reply it belongs
+        to isn't lost.
+        """
+        line = str(line, 'utf-8')
+        if line[:1] in self._b:
+            self._b[line[0]].append(line[1:])
+        elif line:
+            self._unread.append(line)
+
+
     def get_file_text(self):
         return
 
@@ -92,6 +108,67 @@ class IncomingComms:
 
 
 
+    def read_replies(self, sequences, stall_reads=20):
+        """Read the replies to a burst of commands.
+
+        Each command is sent followed by '@' and a sequence number, which the
+        logger echoes once it has replied to the command.  Returns a list of
+        the lines (without their newlines) replying to each.  Log lines and
+        the like go to the buffers as usual, and replies to commands from
+        before the burst are dropped.  Nothing waits on a timeout unless the
+        logger stops sending.
+        """
+        replies = []
+        lines = []
+        pending = b''
+        stalls = 0
+        while len(replies) < len(sequences):
+            if self._unread:
+                line = self._unread.pop(0)
+            else:
+                got = self._s.readline()
+                pending += got
+                if not pending.endswith(b'\n'):
+                    if not got:
+                        stalls += 1
+                        if stalls >= stall_reads:
+                            raise ProtocolException("no reply to '@{}'".format(sequences[len(replies)]))
+                    continue
+                line = str(pending[:-1], 'utf-8')
+                pending = b''
+            if line[:1] in self._b:
+                self._b[line[0]].append(line[1:])
+            elif line.startswith('@'):
+                if line[1:] == str(sequences[len(replies)]):
+                    replies.append(lines)
+                lines = []
+            else:
+                lines.append(line)
+        return replies
+
+
+    def parse_reply(self, expect_cmd_char, lines, multiline=False):
+        """Pick the reply out of lines from read_replies(), as read_stuff()
+        does."""
+        result = []
+        for line in lines:
+            cmd_char = line[:1]
+            body = line[1:]
+            if cmd_char == expect_cmd_char:
+                if not multiline:
+                    return body
+                if len(body) == 0:
+                    return result
+                result.append(body)
+            elif cmd_char in ('X', 'E'):
+                raise ProtocolException(line)
+            elif cmd_char in self._b:
+                self._b[cmd_char].append(body)
+            else:
+                logging.debug("DROPPED: " + line)
+        raise ProtocolException("no '{}' reply".format(expect_cmd_char), lines)
+
+
     def sizes(self):
         return {key:len(self._b[key]) for key in self._b}
 
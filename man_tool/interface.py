@@ -1,11 +1,60 @@
+import calendar
+import io
+import os
 import time
 import serial
 
+import binary_log
+import block_download
 import incoming_comms
 
 class DataLoggerFault(Exception):
     pass
 
+
+def _trim_padding(filename):
+    """Cut the unused end off a pre-allocated log file.
+
+    A log file that was still being written when the logger lost power is
+    left at its pre-allocated size, the unused part being zeros (or 0xFF,
+    depending on the card).
+    """
+    with open(filename, 'rb+') as f:
+        data = f.read()
+        f.truncate(len(data.rstrip(b'\0\xff')))
+
+def _csv_records(data):
+    """(time, fields) for each line of a CSV log's bytes."""
+    for line in data.rstrip(b'\0\xff').decode('latin-1').splitlines():
+        if not line or line.startswith('#'):
+            continue
+        stamp, _, rest = line.partition(',')
+        yield calendar.timegm(time.strptime(stamp, "%Y-%m-%d %H:%M:%S")), rest.split(',') if rest else []
+
+# Upper limits, in microseconds, of the buckets of the logger's timing
+# histograms (see library/timing_histogram.h); the last bucket has none.
+TIMING_BUCKET_LIMITS = [256 * 4 ** i for i in range(7)]
+
+
+def format_timing(timing):
+    """The histograms from DataLoggerInterface.get_timing() as lines of a
+    table, one row each."""
+    def duration(us):
+        return "{:.3g}ms".format(us / 1000) if us < 1000000 else "{:.3g}s".format(us / 1000000)
+
+    heads = ["<" + duration(limit) for limit in TIMING_BUCKET_LIMITS]
+    heads.append(">=" + duration(TIMING_BUCKET_LIMITS[-1]))
+    heads.append("longest")
+    rows = [("",) + tuple(heads)]
+    for name in ('write', 'flush', 'command'):
+        rows.append((name,) + tuple(timing[name][0]) + (duration(timing[name][1]),))
+    for kind in ('late', 'run'):
+        for event, (counts, longest) in timing[kind].items():
+            rows.append(("{} {}".format(kind, event),) + tuple(counts) + (duration(longest),))
+    widths = [max(len(str(row[i])) for row in rows) for i in range(len(rows[0]))]
+    return ["  ".join(str(field).rjust(width) for field, width in zip(row, widths)).rstrip() for row in rows]
+
+
 class DataLoggerInterface:
     """Wrapper to control Coweeta's Arduino based datalogger.
 
@@ -17,18 +66,22 @@ class DataLoggerInterface:
 
         deviceName would be something like "/dev/ttyUSB0"
         """
-        self.ser = serial.Serial(device_name, 250000, xonxoff=1, rtscts=0, timeout=0.1)
+        # No flow control: the frames of a block download are raw binary, so
+        # XON and XOFF bytes in them would be taken out by the tty.
+        self.ser = serial.Serial(device_name, 250000, xonxoff=0, rtscts=0, timeout=0.1)
         self.incoming = incoming_comms.IncomingComms(self.ser)
         self.debug = debug
         self._download_file = None
         self._download_filename = None
+        self._download = None
+        self._download_keep = False
         self._file_bytes_left = 0
+        self._sequence = 0
         time.sleep(2)
-        self.check_protocol_version()
-        self._event_names = self._write_and_read("n").split()
-
-        # turn on dumping
-        self._write_and_read("o1")
+        # One round trip: check the version, get the names and turn on dumping.
+        version, names, _ = self._send_commands(["v", "n", "o1"])
+        self._check_version(self.incoming.parse_reply('v', version).strip())
+        self._event_names = self.incoming.parse_reply('n', names).split()
 
 
     def __del__(self):
@@ -43,11 +96,28 @@ class DataLoggerInterface:
             print("flush got '{}'".format(out))
 
 
+    def _send_commands(self, commands):
+        """Send the commands in one burst and return the lines replying to each.
+
+        Each is followed by an '@' command with a sequence number, which the
+        logger echoes once it has replied, so that the replies can be told
+        apart as soon as they arrive rather than after a timeout.  The
+        leading space wakes a logger that is powered down.
+        """
+        sequences = []
+        burst = ' '
+        for text in commands:
+            self._sequence = (self._sequence + 1) % 65536
+            sequences.append(self._sequence)
+            burst += '{}\n@{}\n'.format(text, self._sequence)
+        self.ser.write(bytes(burst, 'utf-8'))
+        return self.incoming.read_replies(sequences)
+
+
     def _write_and_read(self, text, multiline=False):
         """private method to send command and handle output"""
-        #TEMP!!! self._flush()
-        self.ser.write(bytes(text + '\n', 'utf-8'))
-        return self.incoming.read_stuff(text[0], multiline)
+        (lines,) = self._send_commands([text])
+        return self.incoming.parse_reply(text[0], lines, multiline)
 
 
     def get_event_names(self, trigger_mask=None):
@@ -62,7 +132,10 @@ class DataLoggerInterface:
 
 
     def check_protocol_version(self):
-        version_string = self._write_and_read("v").strip()
+        self._check_version(self._write_and_read("v").strip())
+
+
+    def _check_version(self, version_string):
         #if len(version_response) != 1:
         #    raise DataLoggerFault("Device may not be a Coweeta data logger", version_response)
         #version_string = str(version_response[0])
@@ -72,6 +145,22 @@ class DataLoggerInterface:
             raise DataLoggerFault("Device uses newer protocol than this application supports", version_string)
 
 
+    def get_status(self):
+        """The wait for the next event, the slots each event has missed, the
+        logger's time, the active file's number and name and the files on the
+        card, in one round trip."""
+        wait, now, active, files = self._send_commands(["w", "t", "A", "L"])
+        wait = self.incoming.parse_reply('w', wait)
+        active_num, active_filename = self._parse_active(self.incoming.parse_reply('A', active))
+        return {
+            'wait': self._parse_wait(wait),
+            'missed': self._parse_missed(wait),
+            'time': int(self.incoming.parse_reply('t', now)),
+            'active_file': active_num,
+            'active_filename': active_filename,
+            'files': self._parse_files(self.incoming.parse_reply('L', files, multiline=True))}
+
+
     # def wait_for_prompt(self):
     #     for attempt in range(50):
     #       got = self.ser.read()
@@ -82,38 +171,140 @@ class DataLoggerInterface:
     #     return False
 
 
-    def start_download_file(self, filename):
+    def _resume_offset(self, filename):
+        """How much of the file we already hold, or 0 if our copy (if any)
+        isn't the same as the start of the logger's.
+
+        Checking the last sector's worth is enough to tell.
+        """
+        if not os.path.exists(filename):
+            return 0
+        size = os.path.getsize(filename)
+        start = max(0, size - block_download.BLOCK_SIZE)
+        crc, count = block_download.crc_of_file(filename, start, size - start)
+        their_crc, their_count = self._write_and_read(
+            "C{} {} {}".format(filename, start, count)).split()
+        if (int(their_crc), int(their_count)) != (crc, count):
+            return 0
+        return size
+
+
+    def start_download_file(self, filename, resume=False):
+        """Start fetching the file into the current directory.
+
+        With resume, a copy already there is topped up with whatever the
+        logger has added since (or the rest of a broken download), and the
+        file is left on the logger so that it can be topped up again later.
+        """
         self._download_filename = filename
+        self._download_keep = resume
         if self._file_bytes_left != 0:
             print("ERROR", self._file_bytes_left)   #TEMP!!! how to handle????
 
         self._flush()
-        self.ser.write(bytes("G{}|".format(filename), 'utf-8'))
-        size_line = self.ser.readline()
-        print("###", size_line)
-        self._file_bytes_left = int(size_line)
-        self._download_file = open(filename, 'wb')
+        offset = self._resume_offset(filename) if resume else 0
+        line = self._send_block_command("B{} {}".format(filename, offset))
+        self._file_bytes_left = max(0, int(line[1:]) - offset)
+        self._download_file = open(filename, 'rb+' if offset else 'wb')
+        self._download_file.truncate(offset)
+        self._download_file.seek(offset)
+        self._download = block_download.BlockReceiver(
+            self.ser, self._download_file, self.incoming.take_line, offset)
+
+
+    def _send_block_command(self, text, timeout=5.0):
+        """Send a command that is answered with a line and then frames of a
+        file (see block_download.py), and return the line.
+
+        Log lines arriving in between go to the incoming buffers as usual.
+        The reply is read a line at a time so as not to take any of the
+        frames with it.  The logger may take a while to open the file or
+        search its index, so reads that time out are retried until timeout
+        seconds have gone by.  The leading space wakes a logger that is
+        powered down.
+        """
+        self.ser.write(bytes(' ' + text + "\n", 'utf-8'))
+        deadline = time.monotonic() + timeout
+        pending = b''
+        while True:
+            pending += self.ser.readline()
+            if not pending.endswith(b'\n'):
+                if time.monotonic() > deadline:
+                    raise DataLoggerFault("{} failed: no reply".format(text))
+                continue
+            line, pending = pending, b''
+            if line.startswith(b'X'):
+                raise DataLoggerFault("{} failed: {}".format(text, line))
+            if line.startswith(bytes(text[0], 'utf-8')):
+                return line
+            self.incoming.take_line(line.rstrip(b'\n'))
+
+
+    def _receive_blocks(self, offset):
+        """All the frames following _send_block_command(), from the offset."""
+        out = io.BytesIO()
+        receiver = block_download.BlockReceiver(self.ser, out, self.incoming.take_line, offset)
+        while not receiver.done:
+            receiver.receive()
+        return out.getvalue()
+
+
+    def query_records(self, filename, start, end):
+        """The records in the log file from start to end (seconds since the
+        epoch, both included), as (time, fields) tuples.
+
+        Only the part of the file holding them is fetched (see the 'Q'
+        command), along with the header of a binary log.
+        """
+        reply = self._send_block_command("Q{} {} {}".format(filename, int(start), int(end)))
+        offset, count, base_time, header_offset = (int(field) for field in reply[1:].split())
+        data = self._receive_blocks(offset)
+        if filename.upper().endswith('.BIN'):
+            header = b''
+            if offset:
+                header = self._fetch_header(filename, header_offset, offset)
+            records = ((when, fields) for when, _, fields in binary_log.decode_part(data, base_time, header))
+        else:
+            records = _csv_records(data)
+        return [(when, fields) for when, fields in records if start <= when <= end]
 
 
-    def download_chunk(self):
-        bytes = self.ser.read(min(5000, self._file_bytes_left))
+    def _fetch_header(self, filename, header_offset, end):
+        """The binary log's header at header_offset, which ends before end.
+
+        Its length depends on the schedule, so more is asked for until the
+        whole of it has come.
+        """
+        size = 1024
+        while True:
+            size = min(size, end - header_offset)
+            self._send_block_command("B{} {} {}".format(filename, header_offset, size))
+            header = self._receive_blocks(header_offset)
+            if binary_log.read_header(header) is not None:
+                return header
+            if size == end - header_offset:
+                raise binary_log.BinaryLogError("header at {} cut short".format(header_offset))
+            size *= 2
+
 
-        self._download_file.write(bytes)
-        bytes_read = len(bytes)
+    def download_chunk(self):
+        bytes_read = self._download.receive()
         self._file_bytes_left -= bytes_read
 
-        if self._file_bytes_left == 0:
+        if self._download.done:
             self._download_file.close()
-            term = self.ser.readlines()
-            if len(term) != 1 or term[0] != b">":
-                print("ERROR", term)   #TEMP!!! how to handle????
-            else:
-                self._write_and_read("R{}|".format(self._download_filename))
+            if self._file_bytes_left != 0:
+                print("ERROR", self._file_bytes_left)   #TEMP!!! how to handle????
+            self._file_bytes_left = 0
+            if self._download_filename.upper().endswith('.CSV'):
+                _trim_padding(self._download_filename)
+            if not self._download_keep:
+                self._write_and_read("R{}".format(self._download_filename))
         return (self._file_bytes_left, bytes_read)
 
 
     def abort_download(self):
-        self.ser.write(bytes(" ", 'utf-8'))
+        self.ser.write(bytes(" K\n", 'utf-8'))
         self._flush()
         self._download_file.close()
         self._file_bytes_left = 0
@@ -145,12 +336,25 @@ class DataLoggerInterface:
 
 
     def get_active_file_num(self):
-        line = self._write_and_read("A")
-        return int(line)
+        return self._parse_active(self._write_and_read("A"))[0]
+
+
+    def get_active_filename(self):
+        """The active file's name, LOGnnnnn.CSV or .BIN as the logger is
+        writing text or binary."""
+        return self._parse_active(self._write_and_read("A"))[1]
+
+
+    def _parse_active(self, line):
+        number, filename = line.split()
+        return int(number), filename
 
 
     def list_files(self):
-        lines = self._write_and_read("L", multiline=True)
+        return self._parse_files(self._write_and_read("L", multiline=True))
+
+
+    def _parse_files(self, lines):
         file_list = []
         for line in lines:
             if "\t" in line:
@@ -162,6 +366,19 @@ class DataLoggerInterface:
 
 
 
+    def find_log_files(self, start=None, end=None):
+        """The log files holding records from start to end (seconds since the
+        epoch), or all of them: (name, first time, last time, records) for
+        each, from the logger's index of the files it has written."""
+        command = "I" if start is None else "I{} {}".format(int(start), int(end))
+        files = []
+        for line in self._write_and_read(command, multiline=True):
+            name, first, last, records = line.strip().split(',')
+            files.append((name, int(first), int(last), int(records)))
+        return files
+
+
+
     def trigger_events(self, event_list):
         event_mask = 0
         for event_name in event_list:
@@ -178,7 +395,46 @@ class DataLoggerInterface:
 
 
     def get_next_event(self):
-        delay_str, event_str, enabled_str  = self._write_and_read("w").split()
+        return self._parse_wait(self._write_and_read("w"))
+
+
+    def get_missed_events(self):
+        """The number of slots each event has missed since the logger started
+        (see CatchUp in library/data_logger.h), by event name."""
+        return self._parse_missed(self._write_and_read("w"))
+
+
+    def get_log_stats(self):
+        """The log lines written since the logger started, how many of them
+        were too long for one binary record and how many had fields
+        dropped."""
+        lines, continued, cut_short = self._write_and_read("S").split()
+        return {'lines': int(lines), 'continued': int(continued), 'cut_short': int(cut_short)}
+
+
+    def get_timing(self, clear=False):
+        """The logger's timing histograms, and clear them if asked.
+
+        Each is (counts, longest): the counts of durations in each bucket
+        (see TIMING_BUCKET_LIMITS) and the longest seen, in microseconds.
+        'write' times the card writes, 'flush' the log file flushes and
+        'command' the commands; 'late' and 'run' map each event name to how
+        late it was handled and how long the sketch took over it.  Only a
+        logger built with COWEETA_TIMING=1 has them; others answer 'Ec?'.
+        """
+        timing = {'late': {}, 'run': {}}
+        for line in self._write_and_read("H1" if clear else "H", multiline=True):
+            fields = line.split()
+            histogram = ([int(count) for count in fields[-9:-1]], int(fields[-1]))
+            if fields[0] in timing:
+                timing[fields[0]][self._event_names[int(fields[1])]] = histogram
+            else:
+                timing[fields[0]] = histogram
+        return timing
+
+
+    def _parse_wait(self, line):
+        delay_str, event_str, enabled_str = line.split()[:3]
         delay = int(delay_str)
         event_mask = int(event_str)
         next_event_names = []
@@ -188,6 +444,10 @@ class DataLoggerInterface:
         return delay, next_event_names
 
 
+    def _parse_missed(self, line):
+        return dict(zip(self._event_names, (int(count) for count in line.split()[3:])))
+
+
     def close(self):
         self.ser.close()
 
@@ -2,6 +2,7 @@
 
 import logging
 import datetime
+import time
 import tkinter as tk
 import tkinter.ttk as ttk
 
@@ -14,6 +15,7 @@ import vert_scroll_frame as vsf
 import progress_dialog as prog
 
 import interface
+import binary_log
 
 class AboutDialog(tk.Frame):
     """Just display a simple about box.
@@ -46,6 +48,36 @@ class AboutDialog(tk.Frame):
         top.title("About Coweeta Log")
 
 
+class TimingDialog(tk.Frame):
+    """Show the logger's timing histograms, as a table of counts.
+
+    """
+    def __init__(self, parent, get_timing):
+        top = tk.Toplevel(parent)
+        self._get_timing = get_timing
+
+        self._text = tk.Text(top, font="courier 12", wrap='none', width=100, height=12)
+        self._text.pack(side='top', expand=True, fill='both', padx=10, pady=10)
+
+        buttons = tk.Frame(top)
+        tk.Button(buttons, text="Refresh", command=self._refresh).pack(side='left', padx=10)
+        tk.Button(buttons, text="Clear", command=lambda: self._refresh(clear=True)).pack(side='left', padx=10)
+        tk.Button(buttons, text="Close", command=top.destroy).pack(side='left', padx=10)
+        buttons.pack(side='bottom', pady=10)
+
+        top.title("Logger Timing")
+        self._refresh()
+
+    def _refresh(self, clear=False):
+        self._text.delete('1.0', tk.END)
+        try:
+            lines = self._get_timing(clear)
+        except Exception as error:
+            lines = ["No timing from the logger ({})".format(error),
+                     "It needs building with COWEETA_TIMING=1."]
+        self._text.insert(tk.END, "\n".join(lines))
+
+
 class GuiLoggerInterface(tk.Frame):
     """A Tk based user interface for the Logger controller.
 
@@ -278,6 +310,10 @@ class GuiLoggerInterface(tk.Frame):
 
         self._make_com_port_menu(menu_bar)
 
+        logger_menu = tk.Menu(menu_bar, tearoff=False)
+        logger_menu.add_command(label="Timing...", command=self._show_timing)
+        menu_bar.add_cascade(label="Logger", menu=logger_menu)
+
         help_menu = tk.Menu(menu_bar, tearoff=False)
         help_menu.add_command(label="About", command=self._help_about)
         menu_bar.add_cascade(label="Help", menu=help_menu)
@@ -293,6 +329,10 @@ class GuiLoggerInterface(tk.Frame):
         AboutDialog(self)
 
 
+    def _show_timing(self):
+        TimingDialog(self, self._callbacks['get_timing'])
+
+
     def _make_com_port_menu(self, parent_menu):
         com_ports = serial.tools.list_ports.comports()
         port_menu = tk.Menu(self, tearoff=False)
@@ -332,11 +372,12 @@ if __name__ == "__main__":
         def connect(self, device):
             print("connect to {}".format(device))
             self.control = interface.DataLoggerInterface(device_name=device, debug=True)
-            self._update_file_list()
-            time_delta = self.control.get_time_delta()
-            window.update_time_discrepancy(time_delta)
+            status = self.control.get_status()
+            window.populate_file_list(status['files'], status['active_filename'])
+            window.update_time_discrepancy(status['time'] - time.time())
             event_names = self.control.get_event_names()
             window.update_log_time_window(event_names)
+            window.update_log_time(*status['wait'])
 
         def disconnect(self):
             print("disconnect")
@@ -365,6 +406,9 @@ if __name__ == "__main__":
             print('STEP #TEMP!!! ', bytes_left, bytes_read)
 
             if bytes_left == 0:
+                fetched = self._fetch_filenames[self._current_fetch]
+                if fetched.upper().endswith('.BIN'):
+                    binary_log.convert_file(fetched, fetched[:-4] + '.CSV')
                 self._current_fetch += 1
                 if self._current_fetch == len(self._fetch_filenames):
                     all_done = True
@@ -392,10 +436,7 @@ if __name__ == "__main__":
 
         def get_file_list(self):
             file_list = self.control.list_files()
-            active_num = self.control.get_active_file_num()
-            active_file = "LOGGER{:02}.CSV".format(active_num)
-
-            return file_list, active_file
+            return file_list, self.control.get_active_filename()
 
         def periodic(self):
             if self.control is not None and not self._downloading:
@@ -408,6 +449,11 @@ if __name__ == "__main__":
         def log_now(self, event_names):
             self.control.trigger_events(event_names)
 
+        def get_timing(self, clear):
+            if self.control is None:
+                return ["Not connected."]
+            return interface.format_timing(self.control.get_timing(clear))
+
     bob = Bob()  #TEMP!!! rename
 
     callbacks = {
@@ -416,6 +462,7 @@ if __name__ == "__main__":
         'get_file_list': bob.get_file_list,
         "resync": bob.sync_time,
         "trigger_event": bob.log_now,
+        'get_timing': bob.get_timing,
         'begin_fetch': bob.begin_fetch,
         'step_fetch': bob.step_fetch,
         'halt_fetch': bob.halt_fetch,
@@ -141,8 +141,9 @@ void loop()
       const double r_therm = 1 / ((1 / r_par) - (1 / 10e3));
       //logger.log_float(r_therm, 3);
       const double temp = b_therm / log(r_therm / r_inf) - t_offset;
-      
-      logger.log_float(temp, 3);
+
+      // In thousandths of a degree: formatting a float is slow on the AVR.
+      logger.log_fixed<3>(lround(temp * 1000));
     }
 
     if (msg) {
@@ -2,10 +2,110 @@
 #define ARDUINO_H
 
 /// Used to build Arduino code for local host for testing.
+///
+/// Time is virtual: millis(), micros() and delay() work off a simulated clock
+/// that only moves when the code under test waits, so a year of logging can be
+/// replayed in seconds.  Serial input is scripted against that clock and
+/// Serial output is counted (and optionally captured).
 
-typedef unsigned char uint8_t;
-typedef unsigned int uint32_t;
-typedef signed int int32_t;
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
 
+#include <string>
+#include <deque>
+
+#include "Stream.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// There is only the one address space here.
+#define PROGMEM
+#define memcpy_P memcpy
+
+enum {
+  LOW = 0,
+  HIGH = 1
+};
+
+enum {
+  INPUT = 0,
+  OUTPUT = 1,
+  INPUT_PULLUP = 2
+};
+
+enum {
+  A0 = 24, A1, A2, A3, A4, A5, A6, A7
+};
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+inline void noInterrupts(void) {}
+inline void interrupts(void) {}
+
+
+/// The simulated clock, in microseconds since the simulation started.
+uint64_t sim_time_us(void);
+
+/// Moves the simulated clock forward to the given time.  Never moves it back.
+void sim_advance_to(uint64_t time_us);
+
+
+/// The USB serial port.  Input is queued up front with script(), each chunk
+/// becoming available at its arrival time.  Output takes as long to send as
+/// it would at the baud rate given to begin() (ten bits a byte), during which
+/// the simulated clock moves on.
+class HardwareSerial : public Stream
+{
+  private:
+    struct Chunk {
+      uint64_t arrival_us;
+      std::string text;
+    };
+    std::deque<Chunk> script_;
+    size_t offset_;
+    unsigned long baud_;
+    bool capture_;
+    bool echo_;
+    std::string transcript_;
+
+  public:
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+
+    HardwareSerial();
+
+    void begin(unsigned long baud);
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t ch);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    /// Queue text to arrive at the given simulated time.
+    void script(uint64_t arrival_us, const char *text);
+
+    /// Time that the next scripted byte arrives; UINT64_MAX if there is none.
+    uint64_t next_arrival_us(void);
+
+    /// Keep a copy of the output (capture) and/or copy it to stdout (echo).
+    void set_capture(bool capture, bool echo=false);
+
+    /// Return, and forget, the output captured so far.
+    std::string take_transcript(void);
+};
+
+extern HardwareSerial Serial;
 
 #endif        //  #ifndef ARDUINO_H
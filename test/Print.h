@@ -0,0 +1,83 @@
+#ifndef PRINT_H
+#define PRINT_H
+
+/// Host stand-in for the Arduino core's Print class.
+///
+/// The number formatting mirrors the AVR core (one divide per digit, floats
+/// printed a digit at a time) so that host timings of the logging path are
+/// representative of where the time goes on the target.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+  private:
+    int write_error_;
+    size_t print_number(unsigned long n, uint8_t base);
+    size_t print_float(double number, uint8_t digits);
+
+  protected:
+    void setWriteError(int err = 1)
+    {
+      write_error_ = err;
+    }
+
+  public:
+    Print() : write_error_(0) {}
+    virtual ~Print() {}
+
+    int getWriteError()
+    {
+      return write_error_;
+    }
+
+    void clearWriteError()
+    {
+      setWriteError(0);
+    }
+
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t write(const char *str)
+    {
+      if (str == NULL) {
+        return 0;
+      }
+      return write((const uint8_t *)str, strlen(str));
+    }
+
+    size_t write(const char *buffer, size_t size)
+    {
+      return write((const uint8_t *)buffer, size);
+    }
+
+    virtual void flush() {}
+
+    size_t print(const char str[]);
+    size_t print(char ch);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println(void);
+    size_t println(const char str[]);
+    size_t println(char ch);
+    size_t println(int n, int base = DEC);
+    size_t println(unsigned int n, int base = DEC);
+    size_t println(long n, int base = DEC);
+    size_t println(unsigned long n, int base = DEC);
+    size_t println(double n, int digits = 2);
+};
+
+#endif        //  #ifndef PRINT_H
@@ -0,0 +1,175 @@
+#ifndef SDFAT_H
+#define SDFAT_H
+
+/// Host stand-in for Bill Greiman's SdFat library: an in-memory card with a
+/// flat root directory.
+///
+/// Alongside the data, the card keeps a rough model of what the real thing
+/// would do at the block level - one shared 512 byte cache, directory entry
+/// updates on sync, FAT updates as files grow - and counts the resulting
+/// sector traffic in SdFat::stats.
+///
+/// Contiguous files (File::createContiguous()) are given a range of block
+/// numbers, which SdSpiCard::writeBlock() writes straight into.
+
+#include "Arduino.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x47
+
+class SdFat;
+
+
+/// Sector traffic counters for the simulated card.
+struct SimCardStats {
+  uint32_t sector_writes;      // data sectors written
+  uint32_t sector_reads;       // data sectors read (including read-modify-write)
+  uint32_t meta_writes;        // directory entry and FAT sectors written
+  uint32_t dir_sector_reads;   // directory sectors read by lookups
+  uint32_t syncs;              // File::flush()/sync()/close() calls that hit the card
+  uint32_t bytes_written;      // bytes passed to File::write()
+};
+
+
+struct SimNode {
+  std::string name;
+  std::vector<uint8_t> data;
+  uint32_t first_block;        // for contiguous files, else 0
+  uint32_t contiguous_size;    // bytes of the file in those blocks; any more
+                               // were appended through the file system
+};
+
+
+/// The raw card, as returned by SdFat::card().
+class SdSpiCard
+{
+  friend class SdFat;
+
+  private:
+    SdFat *sd_;
+
+  public:
+    bool writeBlock(uint32_t block, const uint8_t *src);
+    bool erase(uint32_t first_block, uint32_t last_block);
+};
+
+
+class File : public Stream
+{
+  friend class SdFat;
+
+  private:
+    std::shared_ptr<SimNode> node_;
+    SdFat *card_;
+    uint32_t pos_;
+    uint8_t mode_;
+    int32_t cache_sector_;
+    bool dirty_;
+    bool is_dir_;
+    std::vector<std::string> listing_;
+    size_t next_entry_;
+
+    void touch_sector(uint32_t sector, bool for_write);
+
+  public:
+    File();
+
+    operator bool() const
+    {
+      return (node_ != NULL) || is_dir_;
+    }
+
+    bool isOpen() const
+    {
+      return bool(*this);
+    }
+
+    bool isDirectory() const
+    {
+      return is_dir_;
+    }
+
+    uint32_t size() const;
+    uint32_t position() const
+    {
+      return pos_;
+    }
+    bool seek(uint32_t pos);
+
+    int available();
+    int read();
+    int peek();
+    int read(void *buffer, size_t count);
+
+    size_t write(uint8_t ch);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    void flush();
+    bool sync();
+    void close();
+
+    bool createContiguous(const char *path, uint32_t size);
+    bool contiguousRange(uint32_t *first_block, uint32_t *last_block);
+    bool truncate(uint32_t length);
+
+    bool getName(char *name, size_t size);
+    void rewindDirectory();
+    File openNextFile(uint8_t mode = FILE_READ);
+};
+
+
+class SdFat
+{
+  friend class File;
+  friend class SdSpiCard;
+
+  private:
+    mutable std::map<std::string, std::shared_ptr<SimNode> > files_;
+    bool present_;
+    SdSpiCard card_;
+    uint32_t next_block_;
+    uint8_t cache_[512];
+
+    SimNode *node_at_block(uint32_t block, uint32_t *offset);
+
+    static std::string key(const char *path);
+    void count_dir_scan(void) const;
+    File open_entry(const std::string &name, uint8_t mode) const;
+
+  public:
+    mutable SimCardStats stats;
+
+    SdFat();
+
+    bool begin(uint8_t cs_pin);
+    bool exists(const char *path) const;
+    File open(const char *path, uint8_t mode = FILE_READ) const;
+    bool remove(const char *path);
+
+    SdSpiCard *card()
+    {
+      return &card_;
+    }
+
+    /// Drop the block cache, after writing to the card behind its back.
+    uint8_t *cacheClear()
+    {
+      return cache_;
+    }
+
+    /// Simulation control: whether begin() finds a card.
+    void set_present(bool present)
+    {
+      present_ = present;
+    }
+
+    /// Simulation control: direct access to a file's contents.
+    std::vector<uint8_t> *contents(const char *path);
+};
+
+#endif        //  #ifndef SDFAT_H
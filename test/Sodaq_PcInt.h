@@ -0,0 +1,21 @@
+#ifndef SODAQ_PCINT_H
+#define SODAQ_PCINT_H
+
+/// Host stand-in for the Sodaq pin change interrupt library.  Handlers are
+/// remembered so that a simulation can fire them.
+
+#include "Arduino.h"
+
+namespace PcInt {
+
+typedef void (*callback)(void);
+
+void attachInterrupt(uint8_t pin, callback func);
+void detachInterrupt(uint8_t pin);
+
+/// Simulation control: call the handler attached to the pin, if any.
+void fire(uint8_t pin);
+
+} // namespace PcInt
+
+#endif        //  #ifndef SODAQ_PCINT_H
@@ -0,0 +1,37 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+/// Host stand-in for the Arduino core's Stream class.
+///
+/// As on the target, readBytes() and friends block (in virtual time) until the
+/// requested count arrives or the timeout expires.
+
+#include "Print.h"
+
+class Stream : public Print
+{
+  protected:
+    unsigned long timeout_;
+    int timed_read();
+
+  public:
+    Stream() : timeout_(1000) {}
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout)
+    {
+      timeout_ = timeout;
+    }
+
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+      return readBytes((char *)buffer, length);
+    }
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+};
+
+#endif        //  #ifndef STREAM_H
@@ -0,0 +1,191 @@
+#include "Arduino.h"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+
+#include "char_stream.h"
+#include "string_print.h"
+
+static int failures = 0;
+
+static StringPrint file;
+static StringPrint echo;
+static StringPrint expect;
+
+
+static void start(CharStream &stream)
+{
+  file.text.clear();
+  echo.text.clear();
+  expect.text.clear();
+  stream.start(&file, &echo);
+}
+
+
+/// The append_ functions must give just what print() gives, to both of the
+/// line's destinations.
+static void compare(CharStream &stream, const char *what, long value)
+{
+  if ((file.text != expect.text) || (echo.text != expect.text) || (stream.bytes_written() != expect.text.size())) {
+    std::cout << what << " " << value << ": want " << expect.text << ", got " << file.text << " and " << echo.text
+              << "\n";
+    failures++;
+  }
+}
+
+
+static void random_values(long values)
+{
+  CharStream stream;
+  for (long i = 0; i < values; i++) {
+    // All magnitudes, not just big ones.
+    const uint32_t bits = (uint32_t(rand()) << 16) ^ uint32_t(rand());
+    const uint32_t value = bits >> (rand() % 32);
+    start(stream);
+    stream.append_uint(value);
+    expect.print((unsigned long)value);
+    compare(stream, "append_uint", value);
+
+    start(stream);
+    stream.append_int(int32_t(bits));
+    expect.print(long(int32_t(bits)));
+    compare(stream, "append_int", int32_t(bits));
+
+    start(stream);
+    stream.append_fixed(int32_t(bits) % 100000000, 3);
+    expect.print((int32_t(bits) % 100000000) / 1000.0, 3);
+    compare(stream, "append_fixed", int32_t(bits) % 100000000);
+  }
+  for (uint8_t value = 0; value < 100; value++) {
+    start(stream);
+    stream.append_2digit(value);
+    if (value < 10) {
+      expect.print('0');
+    }
+    expect.print(int(value));
+    compare(stream, "append_2digit", value);
+  }
+}
+
+
+typedef void (*LineBuilder)(CharStream &stream, const int32_t *values, uint8_t count);
+
+static void print_ints(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    stream.print(',');
+    stream.print(long(values[i]));
+  }
+}
+
+static void append_ints(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    stream.append_char(',');
+    stream.append_int(values[i]);
+  }
+}
+
+static void print_floats(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    stream.print(',');
+    stream.print(values[i] / 1000.0, 3);
+  }
+}
+
+static void append_fixeds(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    stream.append_char(',');
+    stream.append_fixed(values[i], 3);
+  }
+}
+
+static void print_2digits(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    const uint8_t value = uint8_t(values[i]) % 100;
+    if (value < 10) {
+      stream.print('0');
+    }
+    stream.print(int(value));
+  }
+}
+
+static void append_2digits(CharStream &stream, const int32_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    stream.append_2digit(uint8_t(values[i]) % 100);
+  }
+}
+
+
+/// Time to build a line of fields: nanoseconds per field.
+static double time_lines(LineBuilder build, const int32_t *values, uint8_t count, size_t &bytes)
+{
+  const int lines = 200000;
+  CharStream stream;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int line = 0; line < lines; line++) {
+    file.text.clear();
+    stream.start(&file, NULL);
+    build(stream, values, count);
+    bytes += stream.bytes_written();
+  }
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / (double(lines) * count);
+}
+
+
+/// Twelve channels a line, as am416 logs them: ADC counts, then millivolts
+/// to three places.
+static void benchmark(void)
+{
+  const uint8_t channels = 12;
+  int32_t counts[channels];
+  int32_t millivolts[channels];
+  for (uint8_t c = 0; c < channels; c++) {
+    counts[c] = (rand() % 65536) - 32768;
+    millivolts[c] = (rand() % 2500000) - 250000;
+  }
+  static const struct {
+    const char *name;
+    LineBuilder old_way;
+    LineBuilder new_way;
+    const int32_t *values;
+  } fields[] = {
+    {"int", print_ints, append_ints, counts},
+    {"fixed, 3 places", print_floats, append_fixeds, millivolts},
+    {"2 digit", print_2digits, append_2digits, counts}
+  };
+  size_t bytes = 0;
+  for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+    const double old_ns = time_lines(fields[f].old_way, fields[f].values, channels, bytes);
+    const double new_ns = time_lines(fields[f].new_way, fields[f].values, channels, bytes);
+    std::cout << fields[f].name << ": print() " << old_ns << " ns/field, append_ " << new_ns << " ns/field ("
+              << old_ns / new_ns << " times as fast)\n";
+  }
+  std::cout << "(check " << bytes % 1000 << ")\n";
+}
+
+
+int main(int argc, char **argv) {
+  bool quick = false;
+  long values = 1000000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0) {
+      quick = true;
+    } else {
+      values = atol(argv[i]);
+    }
+  }
+
+  srand(1);
+  random_values(values);
+  std::cout << (failures ? "FAILED" : "passed") << ": " << values << " random values\n";
+  if (!quick && !failures) {
+    benchmark();
+  }
+  return failures != 0;
+}
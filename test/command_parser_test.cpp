@@ -1,104 +1,372 @@
+/// Tests, fuzzes and times CommandParser.
+///
+/// Usage: command_parser_test [-q] [lines]
+///
+/// Fixed cases are checked first, then the given number (default 200000) of
+/// random lines, with random signatures, are checked against a simple
+/// reference parser.  Then comes a throughput benchmark over a typical mix of
+/// commands, unless -q.  Built with the sanitizers (make check does), this
+/// also shows the parser stays in bounds whatever it is fed.
+
 #include "Arduino.h"
+#include <chrono>
 #include <iostream>
-#include <string.h>
+#include <string>
+#include <vector>
 #include <stdio.h>
-
+#include <stdlib.h>
+#include <string.h>
 
 #include "command_parser.h"
 
-void test_u_numbers(uint32_t val, uint32_t min=0, uint32_t max=0xFFFFFFFF, uint8_t status=NONE)
+static int failures = 0;
+
+
+// One field as the reference parser sees it.
+struct Field {
+  char kind;
+  std::string text;
+  uint64_t value;
+  bool negative;
+};
+
+
+// Parse the line (without its newline) as the protocol says it should be,
+// working on the whole line at once.  Returns the error, if any.
+static char reference(const std::string &line, const std::string &signature, char &command,
+                      std::vector<Field> &fields)
 {
-  char buf[100];
-  snprintf(buf, 100, "%u\n", val);
-  CommandParser cp = CommandParser(buf, strlen(buf));
-  uint32_t got = cp.get_uint32(min, max);
-  uint8_t err = cp.status();
-  if (err != status) {
-    std::cout << "Bad status: want " << int(status) << ", got " << int(err) << " \"" << buf << "\"\n";
-  } else if ((status == NONE) && (got != val)) {
-    std::cout << "Bad val: want " << val << ", got " << got << "\n";
-  } else {
-    std::cout << val << " okay\n";
+  std::string kinds;
+  size_t required = std::string::npos;
+  for (size_t i = 0; i < signature.size(); i++) {
+    if (signature[i] == OPTIONAL_ARGS) {
+      if (required == std::string::npos) {
+        required = kinds.size();
+      }
+    } else {
+      kinds += signature[i];
+    }
+  }
+  if (required == std::string::npos) {
+    required = kinds.size();
+  }
+
+  size_t pos = line.find_first_not_of(' ');
+  if (pos == std::string::npos) {
+    return EMPTY;
+  }
+  command = line[pos++];
+  size_t text_used = 0;
+  fields.clear();
+  while (true) {
+    pos = line.find_first_not_of(' ', pos);
+    if (pos == std::string::npos) {
+      break;
+    }
+    if (fields.size() == kinds.size()) {
+      return EXTRA;
+    }
+    Field field = {kinds[fields.size()], "", 0, false};
+    const size_t end = (field.kind == STRING_ARG) ? line.size() : std::min(line.find(' ', pos), line.size());
+    std::string token = line.substr(pos, end - pos);
+    pos = end;
+    if ((field.kind == WORD_ARG) || (field.kind == STRING_ARG)) {
+      if (text_used + token.size() > CommandParser::TEXT_SIZE - 1) {
+        return TOO_LONG;
+      }
+      text_used += token.size() + 1;
+      field.text = token;
+    } else {
+      const uint64_t limit = (field.kind == WIDE_ARG) ? UINT64_MAX : 0xFFFFFFFF;
+      size_t i = 0;
+      if ((field.kind == INT_ARG) && ((token[0] == '-') || (token[0] == '+'))) {
+        field.negative = token[0] == '-';
+        i = 1;
+      }
+      if (i == token.size()) {
+        return NON_DIGIT;
+      }
+      for (; i < token.size(); i++) {
+        if ((token[i] < '0') || (token[i] > '9')) {
+          return NON_DIGIT;
+        }
+        const uint64_t digit = token[i] - '0';
+        if (field.value > (limit - digit) / 10) {
+          return OVERFLOW;
+        }
+        field.value = field.value * 10 + digit;
+      }
+    }
+    fields.push_back(field);
+  }
+  if (fields.size() < required) {
+    return MISSING;
   }
+  return NONE;
 }
 
-void test_s_numbers(int32_t val, int32_t min=-0x80000000, int32_t max=0x7FFFFFFF, uint8_t status=NONE)
+
+// Feed the line (newline added) to the parser and compare what it finds
+// with the reference, which should give the expected error (if any is given).
+static bool check_line(CommandParser &parser, const std::string &line, const char *signature, int expect=-1)
 {
-  char buf[100];
-  snprintf(buf, 100, "%d\n", val);
-  CommandParser cp = CommandParser(buf, strlen(buf));
-  int32_t got = cp.get_int32(min, max);
-  uint8_t err = cp.status();
-  if (err != status) {
-    std::cout << "Bad status: want " << int(status) << ", got " << int(err) << " \"" << buf << "\"\n";
-  } else if ((status == NONE) && (got != val)) {
-    std::cout << "Bad val: want " << val << ", got " << got << "\n";
-  } else {
-    std::cout << val << " okay\n";
+  char want_command = '\0';
+  std::vector<Field> want_fields;
+  const char want_error = reference(line, signature, want_command, want_fields);
+  if ((expect >= 0) && (want_error != expect)) {
+    std::cout << "FAIL: reference gives \"" << line << "\" error " << int(want_error) << "\n";
+    failures++;
   }
+
+  const std::string input = line + "\n";
+  int commands = 0;
+  int lines = 0;
+  for (size_t i = 0; i < input.size(); i++) {
+    const uint8_t found = parser.add(input[i]);
+    if (found == CommandParser::COMMAND) {
+      commands++;
+      parser.set_signature(signature);
+    } else if (found == CommandParser::LINE) {
+      lines++;
+      if (i != input.size() - 1) {
+        break;
+      }
+    }
+  }
+
+  std::string problem;
+  if ((lines != 1) || (commands != (want_error == EMPTY ? 0 : 1))) {
+    problem = "bad COMMAND/LINE sequence";
+  } else if (parser.error() != want_error) {
+    problem = std::string("error ") + (parser.error() ? parser.error() : '0') + ", want " +
+              (want_error ? want_error : '0');
+  } else if (!want_error && (parser.command() != want_command)) {
+    problem = "wrong command";
+  } else if (!want_error) {
+    for (size_t i = 0; i < want_fields.size() && problem.empty(); i++) {
+      const Field &want = want_fields[i];
+      if (!parser.has_more()) {
+        problem = "too few fields";
+      } else if ((want.kind == WORD_ARG) || (want.kind == STRING_ARG)) {
+        if (want.text != parser.get_word()) {
+          problem = "wrong text";
+        }
+      } else if (want.kind == INT_ARG) {
+        const bool fits = want.negative ? (want.value <= 0x80000000) : (want.value <= 0x7FFFFFFF);
+        const int64_t value = parser.get_int32();
+        if (fits ? (value != (want.negative ? -int64_t(want.value) : int64_t(want.value)))
+                 : (parser.error() != RANGE)) {
+          problem = "wrong signed value";
+        }
+        if (!fits) {
+          break;
+        }
+      } else if (parser.get_uint64() != want.value) {
+        problem = "wrong value";
+      }
+    }
+    if (problem.empty() && !parser.error() && parser.has_more()) {
+      problem = "too many fields";
+    }
+  }
+  if (!problem.empty()) {
+    std::cout << "FAIL: \"" << line << "\" signature \"" << signature << "\": " << problem << "\n";
+    failures++;
+    return false;
+  }
+  return true;
 }
 
-int main() {
 
+static void test_u_numbers(CommandParser &parser, uint32_t val, uint32_t min=0, uint32_t max=0xFFFFFFFF,
+                           uint8_t status=NONE)
+{
   char buf[100];
-  strcpy(buf, "  H there 123456789 -456 678 +0 0 bob  this is the end \n");
+  snprintf(buf, 100, "N%u\n", val);
+  for (const char *p = buf; *p; p++) {
+    if (parser.add(*p) == CommandParser::COMMAND) {
+      parser.set_signature("u");
+    }
+  }
+  const uint32_t got = parser.get_uint32(min, max);
+  if ((parser.error() != status) || ((status == NONE) && (got != val))) {
+    std::cout << "FAIL: " << val << " in [" << min << ", " << max << "]: got " << got << " status "
+              << int(parser.error()) << "\n";
+    failures++;
+  }
+}
 
 
-  std::cout << buf << "\n";
-  CommandParser cp = CommandParser(buf, strlen(buf));
+static void test_s_numbers(CommandParser &parser, int32_t val, int32_t min=-0x80000000, int32_t max=0x7FFFFFFF,
+                           uint8_t status=NONE)
+{
+  char buf[100];
+  snprintf(buf, 100, "s %d\n", val);
+  for (const char *p = buf; *p; p++) {
+    if (parser.add(*p) == CommandParser::COMMAND) {
+      parser.set_signature("i");
+    }
+  }
+  const int32_t got = parser.get_int32(min, max);
+  if ((parser.error() != status) || ((status == NONE) && (got != val))) {
+    std::cout << "FAIL: " << val << " in [" << min << ", " << max << "]: got " << got << " status "
+              << int(parser.error()) << "\n";
+    failures++;
+  }
+}
 
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
 
-  std::cout << "CMD = '" << char(cp.get_char()) << "'\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+static void fixed_cases(CommandParser &parser)
+{
+  check_line(parser, "  H there 123456789 -456 this is the end ", "wui?s", NONE);
+  check_line(parser, "GLOG00000.CSV", "w?uu", NONE);
+  check_line(parser, "BLOG00000.BIN 4096", "w?uu", NONE);
+  check_line(parser, "BLOG00000.BIN 4096 512 7", "w?uu", EXTRA);
+  check_line(parser, "B", "w?uu", MISSING);
+  check_line(parser, "e3", "u", NONE);
+  check_line(parser, "e 3x", "u", NON_DIGIT);
+  check_line(parser, "e 4294967296", "u", OVERFLOW);
+  check_line(parser, "e 18446744073709551615", "U", NONE);
+  check_line(parser, "e 18446744073709551616", "U", OVERFLOW);
+  check_line(parser, "s -", "i", NON_DIGIT);
+  check_line(parser, "s +17", "i", NONE);
+  check_line(parser, "    ", "", EMPTY);
+  check_line(parser, "v ", "", NONE);
+  check_line(parser, "v x", "", EXTRA);
+  check_line(parser, "R " + std::string(70, 'a'), "w", TOO_LONG);
+  check_line(parser, "R " + std::string(300, ' ') + "ok", "w", NONE);
 
-  std::cout << "WORD = \"" << cp.get_word() << "\"\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+  test_u_numbers(parser, 100);
+  test_u_numbers(parser, 0xFFFFFFFF);
+  test_u_numbers(parser, 0);
+  test_u_numbers(parser, 0, 0, 10);
+  test_u_numbers(parser, 10, 0, 10);
+  test_u_numbers(parser, 0, 1, 10, RANGE);
+  test_u_numbers(parser, 11, 0, 10, RANGE);
 
-  std::cout << "NUM = " << cp.get_uint32(10000, 0xFFFFFFFF) << "\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+  test_s_numbers(parser, 0);
+  test_s_numbers(parser, -100);
+  test_s_numbers(parser, 100);
+  test_s_numbers(parser, -0x80000000);
+  test_s_numbers(parser, 0x7FFFFFFF);
+  test_s_numbers(parser, 0, -7, 9);
+  test_s_numbers(parser, -7, -7, 9);
+  test_s_numbers(parser, 9, -7, 9);
+  test_s_numbers(parser, -8, -7, 9, RANGE);
+  test_s_numbers(parser, 10, -7, 9, RANGE);
 
-  std::cout << "NUM = " << cp.get_int32(-1000, 1000) << "\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+  test_s_numbers(parser, -6, -10, -6);
+  test_s_numbers(parser, -11, -10, -6, RANGE);
+  test_s_numbers(parser, -5, -10, -6, RANGE);
+}
 
-  std::cout << "NUM = " << cp.get_int32(-1000, 1000) << "\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
 
-  std::cout << "NUM = " << cp.get_int32(-1000, 1000) << "\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+// A random token, likely to be near the edges of what the kinds accept.
+static std::string random_token(void)
+{
+  static const char *const pieces[] = {
+    "0", "7", "42", "4294967295", "4294967296", "18446744073709551615", "18446744073709551616",
+    "2147483648", "-", "+", "x", "LOG00000.BIN", "", "99999999999999999999999"
+  };
+  std::string token;
+  const int parts = 1 + rand() % 3;
+  for (int i = 0; i < parts; i++) {
+    if (rand() % 3) {
+      token += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    } else {
+      const int length = rand() % 40;
+      for (int j = 0; j < length; j++) {
+        token += "0123456789-+ab_. "[rand() % 17];
+      }
+    }
+  }
+  return token;
+}
 
-  std::cout << "NUM = " << cp.get_int32(-1000, 1000) << "\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
 
-  std::cout << "WORD = \"" << cp.get_word() << "\"\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+static void fuzz(CommandParser &parser, long lines)
+{
+  static const char kinds[] = {WORD_ARG, STRING_ARG, UINT_ARG, INT_ARG, WIDE_ARG};
+  for (long n = 0; n < lines; n++) {
+    // Up to MAX_ARGS fields, the later ones perhaps optional.
+    char signature[CommandParser::MAX_SIGNATURE + 1];
+    const int size = rand() % (CommandParser::MAX_ARGS + 1);
+    const int optional = rand() % (CommandParser::MAX_ARGS + 2);
+    int i = 0;
+    for (int k = 0; k < size; k++) {
+      if (k == optional) {
+        signature[i++] = OPTIONAL_ARGS;
+      }
+      signature[i++] = kinds[rand() % sizeof(kinds)];
+    }
+    signature[i] = '\0';
 
-  std::cout << "WORD = \"" << cp.get_string() << "\"\n";
-  std::cout << "STAT = (" << int(cp.status()) << ")\n\n";
+    std::string line(rand() % 3, ' ');
+    if (rand() % 20) {
+      line += "BeGNsx"[rand() % 6];
+    }
+    const int tokens = rand() % 7;
+    for (int t = 0; t < tokens; t++) {
+      line += std::string(rand() % 3 ? 1 : 1 + rand() % 100, ' ');
+      line += random_token();
+    }
+    if (!check_line(parser, line, signature) && (failures > 20)) {
+      return;
+    }
+  }
+}
 
-  test_u_numbers(100);
-  test_u_numbers(0xFFFFFFFF);
-  test_u_numbers(0);
-  test_u_numbers(0, 0, 10);
-  test_u_numbers(10, 0, 10);
-  test_u_numbers(0, 1, 10, RANGE);
-  test_u_numbers(11, 0, 10, RANGE);
 
-  test_s_numbers(0);
-  test_s_numbers(-100);
-  test_s_numbers(100);
-  test_s_numbers(-0x80000000);
-  test_s_numbers(0x7FFFFFFF);
-  test_s_numbers(0, -7, 9);
-  test_s_numbers(-7, -7, 9);
-  test_s_numbers(9, -7, 9);
-  test_s_numbers(-8, -7, 9, RANGE);
-  test_s_numbers(10, -7, 9, RANGE);
+// Time parsing a typical mix of commands, as the logger would see them.
+static void benchmark(CommandParser &parser)
+{
+  static const char *const mix[] = {
+    "BLOG00000.BIN 40960 4096\n", "e3\n", "s1500854400\n", "w\n", "t\n", "E65535\n", "CLOG00001.CSV 0 512\n",
+    "GLOG00002.CSV\n"
+  };
+  static const char *const signatures[] = {"w?uu", "u", "i", "", "", "u", "w?uu", "w?uu"};
+  const int passes = 200000;
+  size_t bytes = 0;
+  uint64_t sum = 0;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++) {
+    for (size_t c = 0; c < sizeof(mix) / sizeof(mix[0]); c++) {
+      for (const char *p = mix[c]; *p; p++) {
+        const uint8_t found = parser.add(*p);
+        if (found == CommandParser::COMMAND) {
+          parser.set_signature(signatures[c]);
+        } else if (found == CommandParser::LINE) {
+          sum += parser.command() + parser.error();
+        }
+        bytes++;
+      }
+    }
+  }
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::cout << "throughput: " << bytes << " bytes in " << ns / 1e6 << " ms, " << ns / bytes << " ns/byte, "
+            << ns / (passes * (sizeof(mix) / sizeof(mix[0]))) << " ns/command (check " << sum % 1000 << ")\n";
+}
 
-  test_s_numbers(-6, -10, -6);
-  test_s_numbers(-11, -10, -6, RANGE);
-  test_s_numbers(-5, -10, -6, RANGE);
 
+int main(int argc, char **argv) {
+  bool quick = false;
+  long lines = 200000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0) {
+      quick = true;
+    } else {
+      lines = atol(argv[i]);
+    }
+  }
 
-  return cp.status();
+  CommandParser parser;
+  srand(1);
+  fixed_cases(parser);
+  fuzz(parser, lines);
+  std::cout << (failures ? "FAILED" : "passed") << ": fixed cases and " << lines << " random lines\n";
+  if (!quick && !failures) {
+    benchmark(parser);
+  }
+  return failures != 0;
 }
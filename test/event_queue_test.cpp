@@ -0,0 +1,77 @@
+#include "Arduino.h"
+#include <iostream>
+#include <stdlib.h>
+
+#include "event_queue.h"
+
+using namespace coweeta;
+
+// Brute force equivalent of EventQueue: the deadline of each queued event.
+static uint32_t due[EventQueue::MAX_EVENTS];
+static bool queued[EventQueue::MAX_EVENTS];
+
+
+static bool check(const EventQueue &queue, int step)
+{
+  uint32_t earliest = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < EventQueue::MAX_EVENTS; i++) {
+    if (queued[i] && (due[i] < earliest)) {
+      earliest = due[i];
+    }
+  }
+  event_mask_t mask = 0;
+  for (uint8_t i = 0; i < EventQueue::MAX_EVENTS; i++) {
+    if (queued[i] && (due[i] == earliest)) {
+      mask |= event_bit(i);
+    }
+  }
+  if (queue.top_time() != earliest) {
+    std::cout << "Bad top at step " << step << ": want " << earliest << ", got " << queue.top_time() << "\n";
+    return false;
+  }
+  if (!queue.empty() && (queue.events_at(earliest) != mask)) {
+    std::cout << "Bad mask at step " << step << ": want " << mask << ", got " << queue.events_at(earliest) << "\n";
+    return false;
+  }
+  return true;
+}
+
+
+int main() {
+  EventQueue queue;
+  srand(1);
+
+  for (int step = 0; step < 100000; step++) {
+    const uint8_t event = rand() % EventQueue::MAX_EVENTS;
+    // Few distinct deadlines, so there are plenty of ties.
+    const uint32_t when = rand() % 20;
+    switch (rand() % 4) {
+      case 0:
+      case 1:
+        queue.insert(event, when);
+        due[event] = when;
+        queued[event] = true;
+        break;
+      case 2:
+        queue.remove(event);
+        queued[event] = false;
+        break;
+      case 3:
+        if (!queue.empty()) {
+          const uint8_t top = queue.top_event();
+          if (!queued[top] || (due[top] != queue.top_time())) {
+            std::cout << "Bad top event at step " << step << "\n";
+            return 1;
+          }
+          due[top] += when;
+          queue.reschedule_top(due[top]);
+        }
+        break;
+    }
+    if (!check(queue, step)) {
+      return 1;
+    }
+  }
+  std::cout << "event queue okay\n";
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "Arduino.h"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+
+#include "char_stream.h"
+#include "fixed_point.h"
+#include "string_print.h"
+
+using namespace coweeta;
+
+static int failures = 0;
+
+
+static void check(int32_t value, uint8_t scale, const char *expect)
+{
+  char text[FIXED_TEXT_SIZE];
+  const uint8_t length = format_fixed(text, value, scale);
+  if ((strcmp(text, expect) != 0) || (length != strlen(expect))) {
+    std::cout << value << " scale " << int(scale) << ": want " << expect << ", got " << text << "\n";
+    failures++;
+  }
+}
+
+
+static double scaled(int32_t value, uint8_t scale)
+{
+  double number = value;
+  for (uint8_t i = 0; i < scale; i++) {
+    number /= 10.0;
+  }
+  return number;
+}
+
+
+/// The text must be what log_float() would have given for the same value, so
+/// that CSV files read the same whichever was used.
+static void compare_with_print(long values)
+{
+  StringPrint expect;
+  for (long i = 0; i < values; i++) {
+    const int32_t value = (rand() % 20000001) - 10000000;
+    const uint8_t scale = rand() % 5;
+    expect.text.clear();
+    expect.print(scaled(value, scale), scale);
+    check(value, scale, expect.text.c_str());
+  }
+}
+
+
+/// Twelve channels of millivolts to three places, as am416 logs them.
+static void benchmark(void)
+{
+  const int sweeps = 200000;
+  const uint8_t channels = 12;
+  int32_t readings[channels];
+  for (uint8_t c = 0; c < channels; c++) {
+    readings[c] = (rand() % 25000) - 2500;
+  }
+  StringPrint line;
+  CharStream stream;
+  size_t bytes = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int sweep = 0; sweep < sweeps; sweep++) {
+    line.text.clear();
+    stream.start(&line, NULL);
+    for (uint8_t c = 0; c < channels; c++) {
+      stream.print(',');
+      stream.print(scaled(readings[c] + sweep % 7, 3), 3);
+    }
+    bytes += stream.bytes_written();
+  }
+  const double float_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (int sweep = 0; sweep < sweeps; sweep++) {
+    line.text.clear();
+    stream.start(&line, NULL);
+    for (uint8_t c = 0; c < channels; c++) {
+      char text[FIXED_TEXT_SIZE];
+      format_fixed(text, readings[c] + sweep % 7, 3);
+      stream.print(',');
+      stream.print(text);
+    }
+    bytes -= stream.bytes_written();
+  }
+  const double fixed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  const double values = double(sweeps) * channels;
+  std::cout << "print(double, 3): " << float_ns / values << " ns/value\n";
+  std::cout << "format_fixed(, 3): " << fixed_ns / values << " ns/value (" << float_ns / fixed_ns
+            << " times as fast, check " << bytes << ")\n";
+}
+
+
+int main(int argc, char **argv) {
+  bool quick = false;
+  long values = 1000000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0) {
+      quick = true;
+    } else {
+      values = atol(argv[i]);
+    }
+  }
+
+  check(0, 0, "0");
+  check(0, 2, "0.00");
+  check(7, 0, "7");
+  check(5, 3, "0.005");
+  check(-5, 2, "-0.05");
+  check(2315, 2, "23.15");
+  check(-2315, 1, "-231.5");
+  check(100, 2, "1.00");
+  check(2147483647, 0, "2147483647");
+  check(-2147483647 - 1, 0, "-2147483648");
+  check(-2147483647 - 1, 9, "-2.147483648");
+  check(1, 9, "0.000000001");
+  check(1, 12, "0.000000001");
+
+  srand(1);
+  compare_with_print(values);
+  std::cout << (failures ? "FAILED" : "passed") << ": fixed cases and " << values << " random values\n";
+  if (!quick && !failures) {
+    benchmark();
+  }
+  return failures != 0;
+}
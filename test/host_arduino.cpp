@@ -0,0 +1,474 @@
+/// Host implementation of the bits of the Arduino core that the library uses.
+
+#include "Arduino.h"
+
+#include <stdio.h>
+
+
+// --- Print ---
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++)) {
+      n++;
+    } else {
+      break;
+    }
+  }
+  return n;
+}
+
+
+size_t Print::print(const char str[])
+{
+  return write(str);
+}
+
+
+size_t Print::print(char ch)
+{
+  return write(uint8_t(ch));
+}
+
+
+size_t Print::print(unsigned char n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+
+// As on AVR, a long is treated as 32 bits wide.
+size_t Print::print(long n, int base)
+{
+  const int32_t value = int32_t(n);
+  if (base == 0) {
+    return write(uint8_t(value));
+  }
+  if (base == 10) {
+    if (value < 0) {
+      const size_t t = print('-');
+      return print_number(uint32_t(-int64_t(value)), 10) + t;
+    }
+    return print_number(uint32_t(value), 10);
+  }
+  return print_number(uint32_t(value), base);
+}
+
+
+size_t Print::print(unsigned long n, int base)
+{
+  if (base == 0) {
+    return write(uint8_t(n));
+  }
+  return print_number(uint32_t(n), base);
+}
+
+
+size_t Print::print(double n, int digits)
+{
+  return print_float(n, digits);
+}
+
+
+size_t Print::println(void)
+{
+  return write("\r\n");
+}
+
+
+size_t Print::println(const char str[])
+{
+  const size_t n = print(str);
+  return n + println();
+}
+
+
+size_t Print::println(char ch)
+{
+  const size_t n = print(ch);
+  return n + println();
+}
+
+
+size_t Print::println(int num, int base)
+{
+  const size_t n = print(num, base);
+  return n + println();
+}
+
+
+size_t Print::println(unsigned int num, int base)
+{
+  const size_t n = print(num, base);
+  return n + println();
+}
+
+
+size_t Print::println(long num, int base)
+{
+  const size_t n = print(num, base);
+  return n + println();
+}
+
+
+size_t Print::println(unsigned long num, int base)
+{
+  const size_t n = print(num, base);
+  return n + println();
+}
+
+
+size_t Print::println(double num, int digits)
+{
+  const size_t n = print(num, digits);
+  return n + println();
+}
+
+
+// Same approach as the AVR core: fill a buffer from the end, one divide per
+// digit.
+size_t Print::print_number(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(uint32_t) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  uint32_t value = uint32_t(n);
+
+  *str = '\0';
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    const uint32_t m = value;
+    value /= base;
+    const char c = m - base * value;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (value);
+
+  return write(str);
+}
+
+
+size_t Print::print_float(double number, uint8_t digits)
+{
+  size_t n = 0;
+
+  if (isnan(number)) {
+    return print("nan");
+  }
+  if (isinf(number)) {
+    return print("inf");
+  }
+  if (number > 4294967040.0) {
+    return print("ovf");
+  }
+  if (number < -4294967040.0) {
+    return print("ovf");
+  }
+
+  if (number < 0.0) {
+    n += print('-');
+    number = -number;
+  }
+
+  double rounding = 0.5;
+  for (uint8_t i = 0; i < digits; ++i) {
+    rounding /= 10.0;
+  }
+  number += rounding;
+
+  const unsigned long int_part = (unsigned long)(uint32_t)number;
+  double remainder = number - (double)int_part;
+  n += print(int_part);
+
+  if (digits > 0) {
+    n += print('.');
+  }
+
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    const unsigned int to_print = (unsigned int)remainder;
+    n += print(to_print);
+    remainder -= to_print;
+  }
+
+  return n;
+}
+
+
+// --- Stream ---
+
+int Stream::timed_read()
+{
+  const unsigned long start = millis();
+  do {
+    const int ch = read();
+    if (ch >= 0) {
+      return ch;
+    }
+    delay(1);
+  } while (millis() - start < timeout_);
+  return -1;
+}
+
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    const int ch = timed_read();
+    if (ch < 0) {
+      break;
+    }
+    *buffer++ = char(ch);
+    count++;
+  }
+  return count;
+}
+
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  size_t index = 0;
+  while (index < length) {
+    const int ch = timed_read();
+    if ((ch < 0) || (ch == terminator)) {
+      break;
+    }
+    *buffer++ = char(ch);
+    index++;
+  }
+  return index;
+}
+
+
+// --- Time and pins ---
+
+static uint64_t now_us_ = 0;
+static uint32_t noise_ = 12345;
+
+
+uint64_t sim_time_us(void)
+{
+  return now_us_;
+}
+
+
+void sim_advance_to(uint64_t time_us)
+{
+  if (time_us > now_us_) {
+    now_us_ = time_us;
+  }
+}
+
+
+unsigned long millis(void)
+{
+  return uint32_t(now_us_ / 1000);
+}
+
+
+unsigned long micros(void)
+{
+  return uint32_t(now_us_);
+}
+
+
+void delay(unsigned long ms)
+{
+  now_us_ += uint64_t(ms) * 1000;
+}
+
+
+void delayMicroseconds(unsigned int us)
+{
+  now_us_ += us;
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+}
+
+
+int digitalRead(uint8_t pin)
+{
+  return LOW;
+}
+
+
+// A wandering 10 bit value so the logs aren't all identical.
+int analogRead(uint8_t pin)
+{
+  noise_ = noise_ * 1103515245 + 12345;
+  return (noise_ >> 16) & 0x3FF;
+}
+
+
+// --- Serial ---
+
+HardwareSerial Serial;
+
+
+HardwareSerial::HardwareSerial() :
+  offset_(0),
+  baud_(0),
+  capture_(false),
+  echo_(false),
+  bytes_in(0),
+  bytes_out(0)
+{
+}
+
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  baud_ = baud;
+}
+
+
+int HardwareSerial::available()
+{
+  int count = 0;
+  size_t offset = offset_;
+  for (std::deque<Chunk>::const_iterator it = script_.begin(); it != script_.end(); ++it) {
+    if (it->arrival_us > now_us_) {
+      break;
+    }
+    count += it->text.size() - offset;
+    offset = 0;
+  }
+  return count;
+}
+
+
+int HardwareSerial::peek()
+{
+  if (script_.empty() || (script_.front().arrival_us > now_us_)) {
+    return -1;
+  }
+  return uint8_t(script_.front().text[offset_]);
+}
+
+
+int HardwareSerial::read()
+{
+  const int ch = peek();
+  if (ch < 0) {
+    return ch;
+  }
+  bytes_in++;
+  offset_++;
+  if (offset_ == script_.front().text.size()) {
+    script_.pop_front();
+    offset_ = 0;
+  }
+  return ch;
+}
+
+
+size_t HardwareSerial::write(uint8_t ch)
+{
+  return write(&ch, 1);
+}
+
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  bytes_out += size;
+  if (baud_) {
+    now_us_ += (uint64_t(size) * 10000000 + baud_ - 1) / baud_;
+  }
+  if (capture_) {
+    transcript_.append((const char *)buffer, size);
+  }
+  if (echo_) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
+
+
+void HardwareSerial::script(uint64_t arrival_us, const char *text)
+{
+  if (*text == '\0') {
+    return;
+  }
+  Chunk chunk = {arrival_us, text};
+  // Keep arrival order, but never jump ahead of a partly read chunk.
+  const std::deque<Chunk>::iterator first = script_.begin() + (offset_ ? 1 : 0);
+  std::deque<Chunk>::iterator it = script_.end();
+  while ((it != first) && ((it - 1)->arrival_us > arrival_us)) {
+    --it;
+  }
+  script_.insert(it, chunk);
+}
+
+
+uint64_t HardwareSerial::next_arrival_us(void)
+{
+  if (script_.empty()) {
+    return UINT64_MAX;
+  }
+  return script_.front().arrival_us;
+}
+
+
+void HardwareSerial::set_capture(bool capture, bool echo)
+{
+  capture_ = capture;
+  echo_ = echo;
+}
+
+
+std::string HardwareSerial::take_transcript(void)
+{
+  std::string text;
+  text.swap(transcript_);
+  return text;
+}
+
+
+// --- Pin change interrupts ---
+
+#include "Sodaq_PcInt.h"
+
+static PcInt::callback pin_handlers_[64];
+
+
+void PcInt::attachInterrupt(uint8_t pin, callback func)
+{
+  pin_handlers_[pin & 0x3F] = func;
+}
+
+
+void PcInt::detachInterrupt(uint8_t pin)
+{
+  pin_handlers_[pin & 0x3F] = NULL;
+}
+
+
+void PcInt::fire(uint8_t pin)
+{
+  if (pin_handlers_[pin & 0x3F]) {
+    pin_handlers_[pin & 0x3F]();
+  }
+}
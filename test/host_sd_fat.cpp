@@ -0,0 +1,428 @@
+/// In-memory SD card for host builds.  See SdFat.h.
+
+#include "SdFat.h"
+
+#include <ctype.h>
+
+static const uint32_t SECTOR_SIZE = 512;
+static const uint32_t CLUSTER_SIZE = 64 * SECTOR_SIZE;
+static const uint32_t DIR_ENTRIES_PER_SECTOR = SECTOR_SIZE / 32;
+static const uint32_t FAT_ENTRIES_PER_SECTOR = SECTOR_SIZE / 4;
+
+
+// As in SdFat, paths not given a directory are looked up on the volume that
+// was last begun.
+static SdFat *cwd_volume_ = NULL;
+
+
+// Sectors of each FAT copy that cover the given number of bytes of a file.
+static uint32_t fat_sectors(uint32_t bytes)
+{
+  const uint32_t clusters = (bytes + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+  return (clusters + FAT_ENTRIES_PER_SECTOR - 1) / FAT_ENTRIES_PER_SECTOR;
+}
+
+
+// --- File ---
+
+File::File() :
+  card_(NULL),
+  pos_(0),
+  mode_(0),
+  cache_sector_(-1),
+  dirty_(false),
+  is_dir_(false),
+  next_entry_(0)
+{
+}
+
+
+// The card has a single block cache.  Moving to a different sector writes the
+// old one back if it was changed, and reads the new one in unless it is about
+// to be completely overwritten.
+void File::touch_sector(uint32_t sector, bool for_write)
+{
+  if (int32_t(sector) == cache_sector_) {
+    return;
+  }
+  if (dirty_) {
+    card_->stats.sector_writes++;
+    dirty_ = false;
+  }
+  const bool whole_new_sector = for_write && (pos_ % SECTOR_SIZE == 0) && (pos_ >= node_->data.size());
+  if (!whole_new_sector) {
+    card_->stats.sector_reads++;
+  }
+  cache_sector_ = sector;
+}
+
+
+uint32_t File::size() const
+{
+  return node_ ? node_->data.size() : 0;
+}
+
+
+bool File::seek(uint32_t pos)
+{
+  if (!node_ || (pos > node_->data.size())) {
+    return false;
+  }
+  pos_ = pos;
+  return true;
+}
+
+
+int File::available()
+{
+  if (!node_) {
+    return 0;
+  }
+  const uint32_t left = node_->data.size() - pos_;
+  return left > 0x7FFF ? 0x7FFF : int(left);
+}
+
+
+int File::peek()
+{
+  if (!node_ || (pos_ >= node_->data.size())) {
+    return -1;
+  }
+  touch_sector(pos_ / SECTOR_SIZE, false);
+  return node_->data[pos_];
+}
+
+
+int File::read()
+{
+  const int ch = peek();
+  if (ch >= 0) {
+    pos_++;
+  }
+  return ch;
+}
+
+
+int File::read(void *buffer, size_t count)
+{
+  uint8_t *dest = (uint8_t *)buffer;
+  size_t i = 0;
+  for (; i < count; i++) {
+    const int ch = read();
+    if (ch < 0) {
+      break;
+    }
+    dest[i] = uint8_t(ch);
+  }
+  return int(i);
+}
+
+
+size_t File::write(uint8_t ch)
+{
+  return write(&ch, 1);
+}
+
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+  if (!node_ || !(mode_ & 0x02)) {
+    setWriteError();
+    return 0;
+  }
+  std::vector<uint8_t> &data = node_->data;
+  for (size_t i = 0; i < size; i++, pos_++) {
+    touch_sector(pos_ / SECTOR_SIZE, true);
+    if (pos_ == data.size()) {
+      if (pos_ % CLUSTER_SIZE == 0) {
+        // New cluster: both FAT copies get updated.
+        card_->stats.meta_writes += 2;
+      }
+      data.push_back(buffer[i]);
+    } else {
+      data[pos_] = buffer[i];
+    }
+    dirty_ = true;
+  }
+  card_->stats.bytes_written += size;
+  return size;
+}
+
+
+void File::flush()
+{
+  sync();
+}
+
+
+// Writes back the cached sector, then updates the directory entry - which
+// evicts the data sector from the card's single cache.
+bool File::sync()
+{
+  if (!node_) {
+    return false;
+  }
+  if (!(mode_ & 0x02)) {
+    return true;
+  }
+  if (dirty_) {
+    card_->stats.sector_writes++;
+    dirty_ = false;
+  }
+  card_->stats.meta_writes++;
+  card_->stats.syncs++;
+  cache_sector_ = -1;
+  return true;
+}
+
+
+void File::close()
+{
+  if (node_) {
+    sync();
+  }
+  node_.reset();
+  is_dir_ = false;
+  listing_.clear();
+}
+
+
+// Allocates the whole file up front: the FAT chain (in both copies) and the
+// directory entry are written once.
+bool File::createContiguous(const char *path, uint32_t size)
+{
+  if ((cwd_volume_ == NULL) || cwd_volume_->exists(path)) {
+    return false;
+  }
+  *this = cwd_volume_->open(path, FILE_WRITE);
+  node_->data.assign(size, 0xA5);  // whatever was on the card before
+  node_->first_block = card_->next_block_;
+  node_->contiguous_size = size;
+  card_->next_block_ += (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  card_->stats.meta_writes += 2 * fat_sectors(size);
+  pos_ = 0;
+  return true;
+}
+
+
+bool File::contiguousRange(uint32_t *first_block, uint32_t *last_block)
+{
+  if (!node_ || !node_->first_block) {
+    return false;
+  }
+  *first_block = node_->first_block;
+  *last_block = node_->first_block + (node_->contiguous_size + SECTOR_SIZE - 1) / SECTOR_SIZE - 1;
+  return true;
+}
+
+
+// Frees the clusters past the new end and updates the directory entry.
+bool File::truncate(uint32_t length)
+{
+  if (!node_ || (length > node_->data.size())) {
+    return false;
+  }
+  card_->stats.meta_writes += 2 * (fat_sectors(node_->data.size()) - fat_sectors(length) + 1) + 1;
+  node_->data.resize(length);
+  if (node_->contiguous_size > length) {
+    node_->contiguous_size = length;
+  }
+  if (pos_ > length) {
+    pos_ = length;
+  }
+  cache_sector_ = -1;
+  dirty_ = false;
+  return true;
+}
+
+
+bool File::getName(char *name, size_t size)
+{
+  const std::string &text = is_dir_ ? std::string("/") : (node_ ? node_->name : std::string());
+  if (text.size() + 1 > size) {
+    return false;
+  }
+  strcpy(name, text.c_str());
+  return true;
+}
+
+
+void File::rewindDirectory()
+{
+  next_entry_ = 0;
+}
+
+
+File File::openNextFile(uint8_t mode)
+{
+  if (!is_dir_ || (next_entry_ >= listing_.size())) {
+    return File();
+  }
+  // Reading through the directory takes a sector for every few entries,
+  // rather than a lookup for each.
+  if (next_entry_ % DIR_ENTRIES_PER_SECTOR == 0) {
+    card_->stats.dir_sector_reads++;
+  }
+  return card_->open_entry(listing_[next_entry_++], mode);
+}
+
+
+// --- SdSpiCard ---
+
+bool SdSpiCard::writeBlock(uint32_t block, const uint8_t *src)
+{
+  uint32_t offset;
+  SimNode *node = sd_->node_at_block(block, &offset);
+  if (!node) {
+    return false;
+  }
+  const uint32_t count = node->data.size() - offset < SECTOR_SIZE ? node->data.size() - offset : SECTOR_SIZE;
+  memcpy(&node->data[offset], src, count);
+  sd_->stats.sector_writes++;
+  sd_->stats.bytes_written += SECTOR_SIZE;
+  return true;
+}
+
+
+// This card reads back zeros after an erase.
+bool SdSpiCard::erase(uint32_t first_block, uint32_t last_block)
+{
+  for (uint32_t block = first_block; block <= last_block; block++) {
+    uint32_t offset;
+    SimNode *node = sd_->node_at_block(block, &offset);
+    if (node) {
+      const uint32_t end = offset + SECTOR_SIZE < node->data.size() ? offset + SECTOR_SIZE : node->data.size();
+      memset(&node->data[offset], 0, end - offset);
+    }
+  }
+  return true;
+}
+
+
+// --- SdFat ---
+
+SdFat::SdFat() :
+  present_(true),
+  next_block_(1)
+{
+  memset(&stats, 0, sizeof(stats));
+  card_.sd_ = this;
+}
+
+
+// Finds the contiguous file holding the block, and the block's offset in it.
+SimNode *SdFat::node_at_block(uint32_t block, uint32_t *offset)
+{
+  for (std::map<std::string, std::shared_ptr<SimNode> >::iterator it = files_.begin(); it != files_.end(); ++it) {
+    SimNode *node = it->second.get();
+    if (node->first_block && (block >= node->first_block)) {
+      const uint32_t start = (block - node->first_block) * SECTOR_SIZE;
+      if (start < node->contiguous_size) {
+        *offset = start;
+        return node;
+      }
+    }
+  }
+  return NULL;
+}
+
+
+std::string SdFat::key(const char *path)
+{
+  while (*path == '/') {
+    path++;
+  }
+  std::string name;
+  for (; *path; path++) {
+    name += char(toupper(*path));
+  }
+  return name;
+}
+
+
+// A lookup reads directory sectors until it finds the entry (or the end).
+// Charge for the whole directory; near enough.
+void SdFat::count_dir_scan(void) const
+{
+  stats.dir_sector_reads += 1 + files_.size() / DIR_ENTRIES_PER_SECTOR;
+}
+
+
+bool SdFat::begin(uint8_t cs_pin)
+{
+  cwd_volume_ = this;
+  return present_;
+}
+
+
+bool SdFat::exists(const char *path) const
+{
+  count_dir_scan();
+  return files_.count(key(path)) != 0;
+}
+
+
+File SdFat::open(const char *path, uint8_t mode) const
+{
+  File file;
+  file.card_ = const_cast<SdFat *>(this);
+  const std::string name = key(path);
+  if (name.empty()) {
+    file.is_dir_ = true;
+    for (std::map<std::string, std::shared_ptr<SimNode> >::const_iterator it = files_.begin();
+         it != files_.end(); ++it) {
+      file.listing_.push_back(it->first);
+    }
+    return file;
+  }
+
+  count_dir_scan();
+  return open_entry(name, mode);
+}
+
+
+// Open the named file, the directory entry having been found.
+File SdFat::open_entry(const std::string &name, uint8_t mode) const
+{
+  File file;
+  file.card_ = const_cast<SdFat *>(this);
+  std::map<std::string, std::shared_ptr<SimNode> >::iterator it = files_.find(name);
+  if (it == files_.end()) {
+    if (mode == FILE_READ) {
+      return File();
+    }
+    std::shared_ptr<SimNode> node(new SimNode);
+    node->name = name;
+    node->first_block = 0;
+    node->contiguous_size = 0;
+    it = files_.insert(std::make_pair(name, node)).first;
+    stats.meta_writes++;
+  }
+  file.node_ = it->second;
+  file.mode_ = mode;
+  if (mode == FILE_WRITE) {
+    file.pos_ = file.node_->data.size();
+  }
+  return file;
+}
+
+
+bool SdFat::remove(const char *path)
+{
+  count_dir_scan();
+  if (files_.erase(key(path)) == 0) {
+    return false;
+  }
+  stats.meta_writes += 3;
+  return true;
+}
+
+
+std::vector<uint8_t> *SdFat::contents(const char *path)
+{
+  std::map<std::string, std::shared_ptr<SimNode> >::iterator it = files_.find(key(path));
+  if (it == files_.end()) {
+    return NULL;
+  }
+  return &it->second->data;
+}
@@ -0,0 +1,615 @@
+/// Replays a sketch's event schedule against the DataLogger core on a PC.
+///
+/// Usage: schedule_sim [-d days] [-c seconds:command]... [-t] [-b] [-p bytes] [-r rotation] [-v] [-l dir] [-o dir] [scenario]
+///
+/// Each scenario is a cut down copy of one of the example sketches: the same
+/// schedule and the same sequence of logging calls, with the sensors replaced
+/// by analogRead() noise.  The -c option queues a command from the management
+/// software to arrive the given number of (virtual) seconds into the run; -t
+/// sleeps tickless, as MayflyDataLogger::set_tickless() does; -b writes binary
+/// log files, as DataLogger::set_log_format() does; -p pre-allocates log files
+/// (DataLogger::set_preallocation()); -r starts new log files daily, weekly,
+/// every so many bytes (e.g. 4096) or records (e.g. 100r), as
+/// DataLogger::set_rotation_policy() does; -v echoes the logger's serial output; -l
+/// starts with the files in a directory on the simulated card (say those saved
+/// from an earlier run) and -o copies the files on the card into a directory
+/// at the end.
+///
+/// As well as the logger's own commands, -c can send 'u', which the simulator
+/// adds (as a sketch would, with DataLogger::add_commands()) to get the
+/// virtual time in seconds, to the microsecond.
+///
+/// At the end a summary of the work done is printed: what starting up cost on
+/// the card, how often the micro woke,
+/// how much it wrote to the card and the serial port, and what it cost in host
+/// CPU time.
+
+#include "Arduino.h"
+#include <SdFat.h>
+
+#include <chrono>
+#include <dirent.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "command_parser.h"
+#include "sim_data_logger.h"
+
+namespace coweeta {
+extern SdFat sd_card_;
+}
+
+using namespace coweeta;
+
+// 2017-07-24 00:00:00 UTC
+static const uint32_t START_TIME = 1500854400;
+
+
+// --- simple.ino ---
+
+static const EventSchedule simple_schedule[] = {
+  event("main", HMS(0, 1, 0))
+};
+
+static void simple_loop(DataLogger &logger)
+{
+  logger.new_log_line();
+  logger.log_int(analogRead(A0));
+  logger.end_log_line();
+}
+
+
+// --- multi_event.ino ---
+
+static const EventSchedule multi_schedule[] = {
+  event("alfa_read", HMS(0, 1, 0)),
+  event("bravo_read_1", HMS(0, 5, 0)),
+  event("bravo_read_2", HMS(0, 5, 0), 10),
+  event("bravo_energize", HMS(0, 5, 0), -10)
+};
+
+static void multi_loop(DataLogger &logger)
+{
+  if (logger.is_event(1 | 2 | 4)) {
+    logger.new_log_line();
+    if (logger.is_event(1)) {
+      logger.log_float((analogRead(A1) - 123) / 17.0, 3);
+      logger.log_string("steady");
+    } else {
+      logger.skip_entries(2);
+    }
+    if (logger.is_event(2 | 4)) {
+      logger.log_int(analogRead(A3));
+    }
+    logger.end_log_line();
+  }
+  if (logger.is_event(8)) {
+    delay(500);
+  }
+}
+
+
+// --- sapflux_tester.ino ---
+
+static const EventSchedule sapflux_schedule[] = {
+  event("log_temp", HMS(0, 0, 1), 0),
+  event("start_seq", HMS(0, 30, 0), -10),
+  event("stop_seq", HMS(0, 30, 0), 90),
+  event("heat_pulse", HMS(0, 30, 0), 0)
+};
+
+static void sapflux_loop(DataLogger &logger)
+{
+  static bool now_logging = false;
+  const char *state = 0;
+
+  if (logger.is_event(2)) {
+    now_logging = true;
+    state = "begin";
+  }
+  if (logger.is_event(4)) {
+    state = "end";
+  }
+  if (logger.is_event(8)) {
+    state = "heat";
+  }
+  if (logger.is_event(1) && now_logging) {
+    logger.new_log_line();
+    const int16_t high_diff = analogRead(A0) - 512;
+    const int16_t low_diff = analogRead(A1) - 512;
+    const float base_temp = 20.0 + analogRead(A2) / 100.0;
+    logger.log_int(high_diff);
+    logger.log_int(low_diff);
+    logger.log_float(base_temp, 2);
+    logger.log_float(base_temp - high_diff * 0.1817, 2);
+    logger.log_float(base_temp - low_diff * 0.1817, 2);
+    logger.log_float((low_diff - high_diff) * 0.1817, 2);
+    logger.log_float(analogRead(A3) * 15.0 / 1024, 2);
+    if (state) {
+      logger.log_string(state);
+    }
+    logger.end_log_line();
+  }
+  if (logger.is_event(8) && now_logging) {
+    delay(500);
+  }
+  if (logger.is_event(4)) {
+    now_logging = false;
+  }
+}
+
+
+// --- am416.ino ---
+
+static const int AM416_CHANNELS = 12;
+
+static const EventSchedule am416_schedule[] = {
+  event("start", HMS(0, 5, 0), -10),
+  event("adc_read", HMS(0, 0, 1), 0, Disabled)
+};
+
+static void am416_loop(DataLogger &logger)
+{
+  static uint16_t step = 0;
+  const char *msg = NULL;
+
+  logger.new_log_line();
+  if (logger.is_event(1)) {
+    logger.enable_events(2);
+    step = 0;
+  }
+  if (logger.is_event(2)) {
+    if (step == 0) {
+      msg = "start";
+    }
+    if (step == 100) {
+      logger.disable_events(2);
+      msg = "end";
+    }
+    step++;
+    for (uint8_t channel = 0; channel < AM416_CHANNELS; channel++) {
+      logger.log_int(analogRead(channel) - 512);
+    }
+    logger.skip_entries(1);
+    for (uint8_t channel = 0; channel < AM416_CHANNELS; channel++) {
+      logger.log_fixed<3>(analogRead(channel) * 100000L / 4096);
+    }
+    if (msg) {
+      logger.log_string(msg);
+    }
+  }
+  logger.end_log_line();
+}
+
+
+// --- sixteen: a full house of events on a 1 s base rate ---
+
+static const EventSchedule sixteen_schedule[] = {
+  event("e0", 1), event("e1", 2), event("e2", 3), event("e3", 4),
+  event("e4", 5), event("e5", 6), event("e6", 10), event("e7", 15),
+  event("e8", 20), event("e9", 30), event("e10", 60), event("e11", 120),
+  event("e12", 300), event("e13", 600), event("e14", 1800), event("e15", 3600)
+};
+
+static void sixteen_loop(DataLogger &logger)
+{
+  if (logger.is_event(0xFFFE)) {
+    logger.new_log_line();
+    logger.log_int(analogRead(A0));
+    logger.end_log_line();
+  }
+}
+
+
+// --- sweep: a 32 channel multiplexer read every 10 seconds, each channel's
+// count and millivolts logged: lines too wide for one binary record ---
+
+static const uint8_t SWEEP_CHANNELS = 32;
+
+static const EventSchedule sweep_schedule[] = {
+  event("sweep", HMS(0, 0, 10))
+};
+
+static void sweep_loop(DataLogger &logger)
+{
+  logger.new_log_line();
+  for (uint8_t channel = 0; channel < SWEEP_CHANNELS; channel++) {
+    const int count = analogRead(A0) - 512;
+    logger.log_int(count);
+    logger.log_fixed<3>(count * 2500000L / 512);
+  }
+  logger.log_string("sweep");
+  logger.end_log_line();
+}
+
+
+// --- rollup: sapflux_tester's temperatures every second, logged as minute
+// summaries (DataLogger::set_aggregation()) ---
+
+static const EventSchedule rollup_schedule[] = {
+  event("sample", HMS(0, 0, 1)),
+  event("report", HMS(0, 1, 0))
+};
+
+static void rollup_setup(DataLogger &logger)
+{
+  static Aggregator columns[] = {
+    Aggregator(Mean | Minimum | Maximum, 2),
+    Aggregator(Mean | StdDev, 2),
+    Aggregator(Count | Mean, 2)
+  };
+  logger.set_aggregation(columns, 2);
+}
+
+static void rollup_loop(DataLogger &logger)
+{
+  if (logger.is_event(1)) {
+    logger.new_log_line();
+    const int16_t high_diff = analogRead(A0) - 512;
+    const float base_temp = 20.0 + analogRead(A2) / 100.0;
+    logger.log_float(base_temp, 2);
+    logger.log_float(base_temp - high_diff * 0.1817, 2);
+    logger.log_float(analogRead(A3) * 15.0 / 1024, 2);
+    logger.end_log_line();
+  }
+}
+
+
+// --- overrun: an hourly event whose loop() takes 35 seconds and then logs a
+// sweep of readings, over the slots of three 10 second events, one for each
+// CatchUp policy ---
+
+static const EventSchedule overrun_schedule[] = {
+  event("skip", HMS(0, 0, 10)),
+  event("once", HMS(0, 0, 10), 5, Normal, RunOnceLate),
+  event("each", HMS(0, 0, 10), 3, Normal, RunEachMissed),
+  event("slow", HMS(1, 0, 0))
+};
+
+static void overrun_loop(DataLogger &logger)
+{
+  static const char *const names[] = {"skip", "once", "each"};
+  for (uint8_t i = 0; i < 3; i++) {
+    if (logger.is_event(event_bit(i))) {
+      logger.new_log_line();
+      logger.log_string(names[i]);
+      logger.log_int(analogRead(A0));
+      logger.end_log_line();
+    }
+  }
+  if (logger.is_event(8)) {
+    delay(35000);
+    for (uint8_t reading = 0; reading < 64; reading++) {
+      logger.new_log_line();
+      logger.log_string("slow");
+      logger.log_int(reading);
+      logger.end_log_line();
+    }
+  }
+}
+
+
+// --- burst: heater_controller_test's 20 Hz sampling, 100 samples every half
+// hour after the heat pulse, and a daily summary ---
+
+static const EventSchedule burst_schedule[] = {
+  event_ms("sample", 50, 0, Disabled),
+  event("pulse", HMS(0, 30, 0)),
+  event("daily", HMS(24, 0, 0))
+};
+
+static void burst_loop(DataLogger &logger)
+{
+  static uint8_t samples = 0;
+  if (logger.is_event(event_bit(1))) {
+    samples = 0;
+    logger.enable_events(event_bit(0));
+  }
+  if (logger.is_event(event_bit(0))) {
+    logger.new_log_line();
+    logger.log_string("sample");
+    logger.log_int(analogRead(A0));
+    logger.end_log_line();
+    if (++samples == 100) {
+      logger.disable_events(event_bit(0));
+    }
+  }
+  if (logger.is_event(event_bit(2))) {
+    logger.new_log_line();
+    logger.log_string("daily");
+    logger.end_log_line();
+  }
+}
+
+
+// --- weekly: a calibration run each Thursday at six in the morning (the epoch
+// was a Thursday), and nothing in between ---
+
+static const EventSchedule weekly_schedule[] = {
+  event("weekly", HMS(24 * 7, 0, 0), HMS(6, 0, 0))
+};
+
+static void weekly_loop(DataLogger &logger)
+{
+  logger.new_log_line();
+  logger.log_string("weekly");
+  logger.end_log_line();
+}
+
+
+#if COWEETA_MAX_EVENTS >= 36
+
+// --- channels: an am416 style multiplexer with an event per channel and phase ---
+
+static const uint8_t CHANNELS = 12;
+
+enum {
+  HEAT,
+  READ_1,
+  READ_2,
+  PHASES
+};
+
+#define CHANNEL_EVENTS(c) \
+  event("heat" #c, HMS(0, 30, 0), 5 * c - 10), \
+  event("read1_" #c, HMS(0, 30, 0), 5 * c), \
+  event("read2_" #c, HMS(0, 30, 0), 5 * c + 60)
+
+static const EventSchedule channels_schedule[] = {
+  CHANNEL_EVENTS(0), CHANNEL_EVENTS(1), CHANNEL_EVENTS(2), CHANNEL_EVENTS(3),
+  CHANNEL_EVENTS(4), CHANNEL_EVENTS(5), CHANNEL_EVENTS(6), CHANNEL_EVENTS(7),
+  CHANNEL_EVENTS(8), CHANNEL_EVENTS(9), CHANNEL_EVENTS(10), CHANNEL_EVENTS(11)
+};
+
+static void channels_loop(DataLogger &logger)
+{
+  for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+    const uint8_t first = channel * PHASES;
+    if (logger.is_event(event_bit(first + HEAT))) {
+      delay(500);
+    }
+    if (logger.is_event(event_bit(first + READ_1) | event_bit(first + READ_2))) {
+      logger.new_log_line();
+      logger.log_int(channel);
+      logger.log_int(analogRead(A0));
+      logger.end_log_line();
+    }
+  }
+}
+
+#endif
+
+
+struct Scenario {
+  const char *name;
+  const EventSchedule *schedule;
+  uint8_t num_events;
+  void (*loop)(DataLogger &logger);
+  void (*setup)(DataLogger &logger);   // or NULL
+};
+
+#define SCENARIO(name, loop, ...) {#name, name##_schedule, sizeof(name##_schedule) / sizeof(EventSchedule), loop, ##__VA_ARGS__}
+
+static const Scenario scenarios[] = {
+  SCENARIO(simple, simple_loop),
+  SCENARIO(multi, multi_loop),
+  SCENARIO(sapflux, sapflux_loop),
+  SCENARIO(am416, am416_loop),
+  SCENARIO(sixteen, sixteen_loop),
+  SCENARIO(sweep, sweep_loop),
+  SCENARIO(rollup, rollup_loop, rollup_setup),
+  SCENARIO(overrun, overrun_loop),
+  SCENARIO(burst, burst_loop),
+  SCENARIO(weekly, weekly_loop),
+#if COWEETA_MAX_EVENTS >= 36
+  SCENARIO(channels, channels_loop),
+#endif
+};
+
+
+static void send_sim_time(CommandParser &)
+{
+  Serial.print('u');
+  Serial.print(uint32_t(sim_time_us() / 1000000));
+  Serial.print('.');
+  char micros[8];
+  snprintf(micros, sizeof(micros), "%06u", unsigned(sim_time_us() % 1000000));
+  Serial.print(micros);
+  Serial.print('\n');
+}
+
+static const CommandEntry sim_commands[] = {
+  {'u', "", send_sim_time}
+};
+
+
+static void usage(void)
+{
+  std::cerr << "usage: schedule_sim [-d days] [-c seconds:command]... [-t] [-b] [-p bytes] [-r rotation] [-v] [-l dir] [-o dir] [scenario]\n";
+  std::cerr << "scenarios:";
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(Scenario); i++) {
+    std::cerr << " " << scenarios[i].name;
+  }
+  std::cerr << "\n";
+  exit(2);
+}
+
+
+// Copy the (plain) files in the directory onto the simulated card.
+static void load_card(const std::string &dir)
+{
+  DIR *in = opendir(dir.c_str());
+  if (!in) {
+    perror(dir.c_str());
+    exit(1);
+  }
+  while (const struct dirent *item = readdir(in)) {
+    FILE *file = fopen((dir + "/" + item->d_name).c_str(), "rb");
+    if (!file || (item->d_name[0] == '.')) {
+      if (file) {
+        fclose(file);
+      }
+      continue;
+    }
+    File entry = sd_card_.open(item->d_name, FILE_WRITE);
+    uint8_t buffer[512];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      entry.write(buffer, len);
+    }
+    entry.close();
+    fclose(file);
+  }
+  closedir(in);
+}
+
+
+// Copy every file on the simulated card into the directory.
+static void save_card(const std::string &dir)
+{
+  File root = sd_card_.open("/");
+  while (true) {
+    File entry = root.openNextFile();
+    if (!entry) {
+      break;
+    }
+    char name[13];
+    entry.getName(name, sizeof(name));
+    const std::vector<uint8_t> *data = sd_card_.contents(name);
+    FILE *out = fopen((dir + "/" + name).c_str(), "wb");
+    if (!out) {
+      perror(name);
+      exit(1);
+    }
+    fwrite(data->data(), 1, data->size(), out);
+    fclose(out);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  double days = 365;
+  bool echo = false;
+  bool tickless = false;
+  bool binary = false;
+  uint32_t preallocation = 0;
+  RotationPolicy rotation = {0, 0, NoPeriod};
+  std::string load_dir;
+  std::string save_dir;
+  const Scenario *scenario = &scenarios[0];
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if ((arg == "-d") && (i + 1 < argc)) {
+      days = atof(argv[++i]);
+    } else if ((arg == "-c") && (i + 1 < argc)) {
+      const std::string spec = argv[++i];
+      const size_t colon = spec.find(':');
+      if (colon == std::string::npos) {
+        usage();
+      }
+      const uint64_t at = uint64_t(atof(spec.substr(0, colon).c_str()) * 1e6);
+      Serial.script(at, (spec.substr(colon + 1) + "\n").c_str());
+    } else if (arg == "-t") {
+      tickless = true;
+    } else if (arg == "-b") {
+      binary = true;
+    } else if ((arg == "-p") && (i + 1 < argc)) {
+      preallocation = strtoul(argv[++i], NULL, 0);
+    } else if ((arg == "-r") && (i + 1 < argc)) {
+      const std::string spec = argv[++i];
+      if (spec == "daily") {
+        rotation.period = Daily;
+      } else if (spec == "weekly") {
+        rotation.period = Weekly;
+      } else if (spec[spec.size() - 1] == 'r') {
+        rotation.records = strtoul(spec.c_str(), NULL, 0);
+      } else {
+        rotation.bytes = strtoul(spec.c_str(), NULL, 0);
+      }
+    } else if (arg == "-v") {
+      echo = true;
+    } else if ((arg == "-l") && (i + 1 < argc)) {
+      load_dir = argv[++i];
+    } else if ((arg == "-o") && (i + 1 < argc)) {
+      save_dir = argv[++i];
+    } else {
+      scenario = NULL;
+      for (size_t s = 0; s < sizeof(scenarios) / sizeof(Scenario); s++) {
+        if (arg == scenarios[s].name) {
+          scenario = &scenarios[s];
+        }
+      }
+      if (!scenario) {
+        usage();
+      }
+    }
+  }
+
+  Serial.set_capture(false, echo);
+
+  if (!load_dir.empty()) {
+    load_card(load_dir);
+  }
+  const SimCardStats card_at_setup = sd_card_.stats;
+
+  SimDataLogger logger(START_TIME);
+  logger.set_tickless(tickless);
+  logger.set_log_format(binary ? BinaryLog : CsvLog);
+  logger.set_preallocation(preallocation);
+  logger.set_rotation_policy(rotation.bytes, rotation.records, rotation.period);
+  logger.add_commands(sim_commands);
+  logger.setup();
+  logger.set_schedule(scenario->schedule, scenario->num_events);
+  if (scenario->setup) {
+    scenario->setup(logger);
+  }
+
+  const SimCardStats card_at_start = sd_card_.stats;
+  const uint64_t start_us = sim_time_us();
+  const uint32_t end_time = START_TIME + uint32_t(days * 86400);
+  uint32_t events = 0;
+
+  const std::chrono::steady_clock::time_point host_start = std::chrono::steady_clock::now();
+  while (logger.get_unix_time() < end_time) {
+    logger.wait_for_event();
+    scenario->loop(logger);
+    events++;
+  }
+  logger.flush_log();
+  const uint64_t awake_us = sim_time_us() - start_us - logger.slept_us;
+  const std::chrono::steady_clock::time_point host_end = std::chrono::steady_clock::now();
+  const double host_ns = std::chrono::duration<double, std::nano>(host_end - host_start).count();
+
+  const SimCardStats &card = sd_card_.stats;
+  const double per_day = 1.0 / days;
+  printf("scenario          %s (%d events), %.1f days, %s, %s log\n", scenario->name, scenario->num_events, days,
+         tickless ? "tickless" : "ticking", binary ? "binary" : "csv");
+  printf("setup             %u directory sector reads, %u data\n",
+         card_at_start.dir_sector_reads - card_at_setup.dir_sector_reads,
+         card_at_start.sector_reads - card_at_setup.sector_reads);
+  printf("events            %u (%.0f/day)\n", events, events * per_day);
+  printf("wakeups           %u (%.0f/day), %u from power down, %u by a wrong alarm\n", logger.wakeups,
+         logger.wakeups * per_day, logger.power_downs, logger.wrong_alarms);
+  printf("awake             %.0f ms (%.0f ms/day)\n", awake_us / 1e3, awake_us / 1e3 * per_day);
+  printf("rtc reads         %u (%.0f/day)\n", logger.rtc_reads, logger.rtc_reads * per_day);
+  printf("card bytes        %u (%.0f/day)\n", card.bytes_written - card_at_start.bytes_written,
+         (card.bytes_written - card_at_start.bytes_written) * per_day);
+  printf("sector writes     %u data, %u metadata (%.0f/day)\n",
+         card.sector_writes - card_at_start.sector_writes,
+         card.meta_writes - card_at_start.meta_writes,
+         (card.sector_writes + card.meta_writes - card_at_start.sector_writes - card_at_start.meta_writes) * per_day);
+  printf("sector reads      %u data, %u directory\n", card.sector_reads - card_at_start.sector_reads,
+         card.dir_sector_reads - card_at_start.dir_sector_reads);
+  printf("card syncs        %u\n", card.syncs - card_at_start.syncs);
+  printf("serial bytes      %u in, %u out\n", Serial.bytes_in, Serial.bytes_out);
+  printf("host cpu          %.0f ms total, %.0f ns/event, %.1f ns/wakeup\n", host_ns / 1e6,
+         events ? host_ns / events : 0.0, logger.wakeups ? host_ns / logger.wakeups : 0.0);
+
+  if (!save_dir.empty()) {
+    save_card(save_dir);
+  }
+  return 0;
+}
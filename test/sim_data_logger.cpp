@@ -0,0 +1,148 @@
+/// DataLogger class implementation for host simulation.  See sim_data_logger.h
+
+#include "sim_data_logger.h"
+
+namespace coweeta
+{
+
+// Use the same pin assignments as the Mayfly; they go nowhere here.
+enum {
+  GREEN_LED_PIN = 8,
+  RED_LED_PIN = 9,
+  SD_CARD_SS_PIN = 12,
+  BUTTON_PIN = 24
+};
+
+static const uint64_t US_PER_SECOND = 1000000;
+static const uint32_t SECONDS_PER_DAY = 86400;
+
+// As MayflyDataLogger's: the RTC alarm can be set less than a day ahead.
+static const uint32_t ALARM_REACH = SECONDS_PER_DAY - 1;
+
+
+SimDataLogger::SimDataLogger(uint32_t start_time) :
+  wakeups(0),
+  power_downs(0),
+  wrong_alarms(0),
+  rtc_reads(0),
+  slept_us(0),
+  epoch_offset_(int64_t(start_time) - int64_t(sim_time_us() / US_PER_SECOND)),
+  tickless_(false),
+  soft_time_valid_(false),
+  cleared_us_(0),
+  synced_us_(0)
+{
+  set_device_pins(GREEN_LED_PIN, RED_LED_PIN, SD_CARD_SS_PIN);
+  set_button_pin(BUTTON_PIN);
+  set_usb_baud_rate(250000);
+}
+
+
+void SimDataLogger::setup(void)
+{
+  DataLogger::setup();
+}
+
+
+void SimDataLogger::set_tickless(bool tickless)
+{
+  tickless_ = tickless;
+}
+
+
+// When the given RTC time will come round on the simulated clock.
+uint64_t SimDataLogger::sim_time_of(uint32_t seconds)
+{
+  return uint64_t(int64_t(seconds) - epoch_offset_) * US_PER_SECOND;
+}
+
+
+// Sleep until the RTC's once a second interrupt, or until serial input
+// arrives, or until an event due part way through the second (the Mayfly's
+// millis() timer wakes it from idle sleep), whichever is first.
+//
+// In tickless mode the RTC alarm is used instead of the tick, under the same
+// conditions as MayflyDataLogger::wait_a_while(), and going off at the first
+// time of day that matches it, as the DS3231's does.  The USART is off while
+// powered down, so the character that wakes us is lost.
+void SimDataLogger::wait_a_while(void)
+{
+  const uint32_t next_time = next_event_time();
+  const uint32_t now_time = current_time();
+  const bool power_down = tickless_ && !usb_session_active() &&
+                          (next_time > now_time + 1) && (next_time != 0xFFFFFFFF);
+  const uint32_t alarm = (next_time - now_time > ALARM_REACH) ? now_time + ALARM_REACH : next_time;
+  uint32_t alarm_match = now_time + (alarm - now_time) % SECONDS_PER_DAY;
+  if (alarm_match == now_time) {
+    alarm_match += SECONDS_PER_DAY;
+  }
+
+  if (power_down) {
+    about_to_power_down();
+  }
+
+  const uint64_t now = sim_time_us();
+  cleared_us_ = now;
+  uint64_t wake = power_down ? sim_time_of(alarm_match) : (now / US_PER_SECOND + 1) * US_PER_SECOND;
+  if (!power_down && (next_time != 0xFFFFFFFF)) {
+    const uint64_t due = sim_time_of(next_time) + uint64_t(next_event_millisecond()) * 1000;
+    if ((due > now) && (due < wake)) {
+      wake = due;
+    }
+  }
+  const uint64_t input = Serial.next_arrival_us();
+  const bool woken_by_input = input < wake;
+  if (woken_by_input) {
+    wake = input;
+  }
+  sim_advance_to(wake);
+  slept_us += wake - now;
+  wakeups++;
+
+  if (power_down) {
+    power_downs++;
+    if (!woken_by_input && (alarm_match != alarm)) {
+      wrong_alarms++;
+    }
+    if (woken_by_input) {
+      Serial.read();
+      soft_time_valid_ = false;
+      note_usb_activity();
+    }
+  }
+}
+
+
+// Counts an RTC read whenever MayflyDataLogger::get_unix_time() would make
+// one: when the software clock isn't set, or when the RTC's interrupt flag has
+// been left uncleared for long enough that ticks were lost.
+uint32_t SimDataLogger::get_unix_time(void)
+{
+  const uint64_t now = sim_time_us();
+  const uint64_t tick = (cleared_us_ / US_PER_SECOND + 1) * US_PER_SECOND;
+  const uint64_t fresh_since = tick > synced_us_ ? tick : synced_us_;
+  if (!soft_time_valid_ || ((now >= tick) && (now - fresh_since > 950000))) {
+    rtc_reads++;
+    synced_us_ = now;
+    soft_time_valid_ = true;
+  }
+  return uint32_t(epoch_offset_ + int64_t(now / US_PER_SECOND));
+}
+
+
+uint32_t SimDataLogger::get_unix_time_ms(uint16_t &millisecond)
+{
+  const uint32_t seconds = get_unix_time();
+  millisecond = sim_time_us() % US_PER_SECOND / 1000;
+  return seconds;
+}
+
+
+void SimDataLogger::set_unix_time(uint32_t seconds)
+{
+  epoch_offset_ = int64_t(seconds) - int64_t(sim_time_us() / US_PER_SECOND);
+  soft_time_valid_ = true;
+}
+
+
+} // namespace coweeta
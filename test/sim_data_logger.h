@@ -0,0 +1,66 @@
+#ifndef SIM_DATA_LOGGER_H
+#define SIM_DATA_LOGGER_H
+
+/// DataLogger harness for running the library on a PC.
+///
+/// The real-time clock is derived from the simulated clock in Arduino.h, the
+/// SD card is the in-memory one in SdFat.h and the USB link is the scripted
+/// Serial object.  Between them a sketch's loop() can be replayed over months
+/// of virtual time while counting what the hardware would have had to do.
+
+#include "data_logger.h"
+
+namespace coweeta
+{
+
+class SimDataLogger : public DataLogger
+{
+  public:
+    /// start_time is the RTC reading (seconds since epoch) at power on.
+    SimDataLogger(uint32_t start_time);
+
+    /// Called from the simulated sketch's setup().
+    void setup(void);
+
+    /// Sleep as the Mayfly does in tickless mode: powered down until the next
+    /// event unless a USB session is active.
+    void set_tickless(bool tickless);
+
+    /// How many times the micro went to sleep and was woken up again.
+    uint32_t wakeups;
+
+    /// How many of those sleeps were in power down mode.
+    uint32_t power_downs;
+
+    /// How many of those power downs the RTC's alarm (which matches on the
+    /// time of day only) would have ended at some other time than it was set
+    /// for, putting the Mayfly's clock out.
+    uint32_t wrong_alarms;
+
+    /// How many times the real-time clock would have been read over I2C.
+    /// As on the Mayfly, the time is kept in software between reads.
+    uint32_t rtc_reads;
+
+    /// Time spent asleep in wait_a_while(); the rest of the run the micro
+    /// was awake.
+    uint64_t slept_us;
+
+    void wait_a_while(void);
+
+    uint32_t get_unix_time(void);
+    uint32_t get_unix_time_ms(uint16_t &millisecond);
+    void set_unix_time(uint32_t seconds);
+
+  private:
+    int64_t epoch_offset_;
+    bool tickless_;
+    bool soft_time_valid_;
+    uint64_t cleared_us_;
+    uint64_t synced_us_;
+
+    uint64_t sim_time_of(uint32_t seconds);
+};
+
+} // namespace coweeta
+
+#endif  // SIM_DATA_LOGGER_H
@@ -1,6 +1,16 @@
+// Throughput benchmark for FileTransfer.
+//
+// Send 'G' or 'B' and a file name (as the management software would) and the
+// file is sent as lines or in blocks, back to back.  Then comes a report of
+// the pieces sent, the time taken and the rate at which the file went, e.g.
+//
+//   #B LOG00000.BIN 20480 bytes, 41 frames, 829 ms, 24704 bytes/s
+//
+// Serial.flush() is called after every piece so the times include waiting
+// for the line, as they would in the logger.
 #include <SdFat.h>
 #include "file_transfer.h"
-#include "junk.h"
+#include "utils.h"
 
 SdFat sd_card;
 
@@ -10,32 +20,53 @@ void setup() {
   Serial.begin(250000);
   Serial.print("Hello\n");
   sd_card.begin(12);
-  junk::print_root_directory(sd_card);
-
+  print_root_directory(sd_card);
 }
 
+
 void loop() {
-  if (Serial.available()) {
-    char filename[20];
-    int len = Serial.readBytesUntil('\n', filename, 20);
-    filename[len] = '\0';
-    Serial.print("\nfile: \"");
+  if (!Serial.available()) {
+    return;
+  }
+  char command[20];
+  const int len = Serial.readBytesUntil('\n', command, sizeof(command) - 1);
+  command[len] = '\0';
+  const bool blocks = (command[0] == 'B');
+  if ((len < 2) || (!blocks && (command[0] != 'G'))) {
+    Serial.print("#usage: G<file name> or B<file name>\n");
+    return;
+  }
+  const char *filename = &command[1];
+
+  FileTransfer transfer;
+  if (!transfer.start(sd_card, filename, 0xFFFFFFFF, blocks)) {
+    Serial.print("#ERROR: can't open ");
     Serial.print(filename);
-    Serial.print("\"\n");
-    FileTransfer ft = FileTransfer(sd_card, filename);
-    if (ft.finished()) {
-      Serial.print("\nERROR!!!!!!!\n");
-    } else {
-      while(!ft.finished()) {
-        const uint32_t t = micros();
-        ft.transfer_line();
-        Serial.flush();
-        Serial.println(micros() - t);
-      }
-      Serial.print("\nDONE\n");
-    }
-    
+    Serial.print("\n");
+    return;
+  }
+  const uint32_t size = transfer.file_size();
+  Serial.flush();
+  const uint32_t start = millis();
+  uint32_t pieces = 0;
+  while (!transfer.finished()) {
+    transfer.transfer_next();
+    Serial.flush();
+    pieces++;
   }
-  // put your main code here, to run repeatedly:
+  const uint32_t elapsed = millis() - start;
 
+  Serial.print("\n#");
+  Serial.print(command[0]);
+  Serial.print(' ');
+  Serial.print(filename);
+  Serial.print(' ');
+  Serial.print(size);
+  Serial.print(" bytes, ");
+  Serial.print(pieces);
+  Serial.print(blocks ? " frames, " : " lines, ");
+  Serial.print(elapsed);
+  Serial.print(" ms, ");
+  Serial.print(elapsed ? size * 1000 / elapsed : 0);
+  Serial.print(" bytes/s\n");
 }
@@ -0,0 +1,29 @@
+#ifndef STRING_PRINT_H
+#define STRING_PRINT_H
+
+#include "Print.h"
+
+#include <string>
+
+/// A Print that keeps what is written to it, for the tests to check.
+class StringPrint : public Print
+{
+public:
+  std::string text;
+
+  size_t write(uint8_t ch)
+  {
+    text += char(ch);
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    text.append(reinterpret_cast<const char *>(buffer), size);
+    return size;
+  }
+
+  using Print::write;
+};
+
+#endif        //  #ifndef STRING_PRINT_H